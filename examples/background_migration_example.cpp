@@ -0,0 +1,36 @@
+// Example of using a background thread for migrations
+// Constructs a small map with background_migration set, so when the
+// table grows a helper thread copies it to the new size while the
+// inserts only copy the parts of it they need
+// Inserts keys [0, 1, 2, ...] from several threads, which grows the
+// table many times, and checks all of them are found
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "unordered_map.h"
+
+int main() {
+  long n = 1000000;
+  int p = 4;
+  parlay::parlay_unordered_map<long, long> map(100, false, true);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < p; t++)
+    threads.emplace_back([&, t] {
+      for (long i = t; i < n; i += p) map.Insert(i, i + 1);});
+  for (auto& th : threads) th.join();
+
+  if (map.size() != n) {
+    std::cout << "error: size " << map.size() << std::endl;
+    abort();
+  }
+  for (long i = 0; i < n; i++) {
+    auto r = map.Find(i);
+    if (!r.has_value() || *r != i + 1) {
+      std::cout << "error at: " << i << std::endl;
+      abort();
+    }
+  }
+  std::cout << "OK" << std::endl;
+}
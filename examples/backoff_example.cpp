@@ -0,0 +1,43 @@
+// Example of using parlay::backoff
+// A retry loop calls pause() after each failed attempt, here to add
+// to a shared total with a compare-and-swap from several threads
+// pause_on(x, v) waits for x to change from v, and parks the thread
+// if the wait is long, so whoever changes x must call wake(x); here
+// the threads wait for a start flag that is set after a delay
+// Checks the total
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <utils/backoff.h>
+
+int main() {
+  long n = 100000;
+  int p = 4;
+  std::atomic<bool> start = false;
+  std::atomic<long> total = 0;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < p; t++)
+    threads.emplace_back([&] {
+      parlay::backoff wait;
+      while (!start.load()) wait.pause_on(start, false);
+      for (long i = 0; i < n; i++) {
+	parlay::backoff bk;
+	long old = total.load();
+	while (!total.compare_exchange_weak(old, old + i)) bk.pause();
+      }});
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  start = true;
+  parlay::backoff::wake(start);
+  for (auto& th : threads) th.join();
+
+  if (total != p * n * (n - 1) / 2) {
+    std::cout << "error: total " << total << std::endl;
+    abort();
+  }
+  std::cout << "OK" << std::endl;
+}
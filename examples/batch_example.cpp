@@ -0,0 +1,48 @@
+// Example of using InsertBatch, UpsertBatch and RemoveBatch
+// Inserts keys [0, 2, 4, ..] with values [0, 1, 2, ..] in one batch
+// Then upserts all of [0, 1, 2, ...], doubling values that are there
+// and setting the others to i, and removes the odd keys
+// Checks the results of each batch and that the table contains [(0,0), (2,2), ...]
+
+#include <iostream>
+#include <utility>
+#include <vector>
+#include "unordered_map.h"
+
+void check(bool b, const char* what, long i) {
+  if (!b) {
+    std::cout << "error in " << what << " at: " << i << std::endl;
+    abort();
+  }
+}
+
+int main() {
+  long n = 100000;
+  parlay::parlay_unordered_map<long, long> map(n);
+
+  std::vector<std::pair<long, long>> kvs(n);
+  for (long i = 0; i < n; i++) kvs[i] = std::pair(2*i, i);
+  std::vector<std::optional<long>> inserted(n);
+  map.InsertBatch(kvs, inserted);
+  for (long i = 0; i < n; i++) check(!inserted[i].has_value(), "insert", i);
+
+  std::vector<long> keys(2*n);
+  for (long i = 0; i < 2*n; i++) keys[i] = i;
+  std::vector<std::optional<long>> old(2*n);
+  map.UpsertBatch(keys, [] (long i, std::optional<long> v) {
+		    return v.has_value() ? 2 * *v : i;}, old);
+  for (long i = 0; i < 2*n; i++)
+    check(old[i].has_value() == (i % 2 == 0), "upsert", i);
+
+  std::vector<long> odd(n);
+  for (long i = 0; i < n; i++) odd[i] = 2*i + 1;
+  std::vector<std::optional<long>> removed(n);
+  map.RemoveBatch(odd, removed);
+  for (long i = 0; i < n; i++)
+    check(removed[i].has_value() && *removed[i] == 2*i + 1, "remove", i);
+
+  check(map.size() == n, "size", 0);
+  for (long i = 0; i < n; i++)
+    check(map.Find(2*i) == std::optional(2*i), "find", 2*i);
+  std::cout << "OK" << std::endl;
+}
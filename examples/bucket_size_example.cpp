@@ -0,0 +1,31 @@
+// Example of setting the bucket size
+// A policy with bucket_bytes = 128 gives buckets of two cache lines,
+// so three 32 byte entries fit in the buffer of a bucket rather than
+// one, and fewer go to the overflow lists
+// Inserts keys [0, 1, 2, ...] with 24 byte values, and checks all
+// keys are found
+
+#include <array>
+#include <iostream>
+#include "unordered_map.h"
+
+struct wide_policy : parlay::default_hash_policy {
+  static constexpr long bucket_bytes = 128;
+};
+
+using value = std::array<long, 3>;
+
+int main() {
+  long n = 100000;
+  parlay::parlay_unordered_map<long, value, std::hash<long>, std::equal_to<long>,
+			       wide_policy> map(n);
+  for (long i = 0; i < n; i++) map.Insert(i, value{i, 2*i, 3*i});
+  for (long i = 0; i < n; i++) {
+    auto r = map.Find(i);
+    if (!r.has_value() || *r != value{i, 2*i, 3*i}) {
+      std::cout << "error at: " << i << std::endl;
+      abort();
+    }
+  }
+  std::cout << "OK" << std::endl;
+}
@@ -0,0 +1,38 @@
+// Example of using build
+// Builds a table from the pairs [(0,0), (1,2), (2,4), ...], which has
+// each key twice, and then rebuilds it from a smaller range
+// Checks the first value of each key is kept, and that building
+// replaces the previous contents
+
+#include <iostream>
+#include <utility>
+#include <vector>
+#include "unordered_map.h"
+
+int main() {
+  long n = 100000;
+  parlay::parlay_unordered_map<long, long> map(1);
+
+  std::vector<std::pair<long, long>> kvs(2*n);
+  for (long i = 0; i < 2*n; i++) kvs[i] = std::pair(i % n, 2*i);
+  map.build(kvs);
+  if (map.size() != n) {
+    std::cout << "error: size " << map.size() << " after build" << std::endl;
+    abort();
+  }
+  for (long i = 0; i < n; i++) {
+    auto r = map.Find(i);
+    if (!r.has_value() || *r != 2*i) {
+      std::cout << "error at: " << i << std::endl;
+      abort();
+    }
+  }
+
+  kvs.resize(10);
+  map.build(kvs);
+  if (map.size() != 10 || map.Find(10).has_value()) {
+    std::cout << "error: rebuild did not replace the contents" << std::endl;
+    abort();
+  }
+  std::cout << "OK" << std::endl;
+}
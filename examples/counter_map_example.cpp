@@ -0,0 +1,43 @@
+// Example of using parlay_counter_map
+// Several threads count occurrences of keys with FetchAdd, which for a
+// key already in the map is a single fetch-and-add on its count, so
+// threads adding to different keys of a bucket do not conflict
+// Checks the counts, and the return values of FetchAdd and Remove
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "counter_map.h"
+
+void check(bool b, const char* what) {
+  if (!b) {
+    std::cout << "error in " << what << std::endl;
+    abort();
+  }
+}
+
+int main() {
+  long n = 100000;
+  int p = 4;
+  long keys = 1000;
+  parlay::parlay_counter_map<long> counts(keys);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < p; t++)
+    threads.emplace_back([&] {
+      for (long i = 0; i < n; i++) counts.FetchAdd(i % keys);});
+  for (auto& th : threads) th.join();
+
+  check(counts.size() == keys, "size");
+  for (long k = 0; k < keys; k++)
+    check(counts.Find(k) == std::optional(p * n / keys), "count");
+  check(counts.FetchAdd(0, 10) == p * n / keys, "fetch_add");
+  check(counts.Remove(0) == std::optional(p * n / keys + 10), "remove");
+  check(!counts.contains(0) && counts.FetchAdd(0, 5) == 0, "fetch_add of new key");
+
+  std::atomic<long> total = 0;
+  counts.for_each([&] (long, long c) {total += c;});
+  check(total == p * n - p * n / keys + 5, "total");
+  std::cout << "OK" << std::endl;
+}
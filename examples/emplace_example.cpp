@@ -0,0 +1,36 @@
+// Example of using Emplace and InsertOrAssign
+// Values are move-only std::unique_ptrs, constructed in place from the
+// arguments, which Insert (taking a const V&) could not store
+// Emplace only constructs a value if the key is not there, while
+// InsertOrAssign replaces the value of a key that is
+// Checks the results and the values in the map
+
+#include <iostream>
+#include <memory>
+#include "unordered_map.h"
+
+void check(bool b, const char* what) {
+  if (!b) {
+    std::cout << "error in " << what << std::endl;
+    abort();
+  }
+}
+
+int main() {
+  long n = 1000;
+  parlay::parlay_unordered_map<long, std::unique_ptr<long>> map(n);
+  for (long i = 0; i < n; i++)
+    check(map.Emplace(i, new long(i)), "emplace of new key");
+  check(!map.Emplace(0, nullptr), "emplace of existing key");
+
+  for (long i = 0; i < n; i += 2)
+    check(!map.InsertOrAssign(i, new long(-i)), "assign of existing key");
+  check(map.InsertOrAssign(n, new long(n)), "insert of new key");
+
+  check(map.size() == n + 1, "size");
+  for (long i = 0; i <= n; i++) {
+    auto r = map.FindRef(i);
+    check(r && **r == ((i % 2 == 0 && i < n) ? -i : i), "value");
+  }
+  std::cout << "OK" << std::endl;
+}
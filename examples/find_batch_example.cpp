@@ -0,0 +1,28 @@
+// Example of using FindBatch
+// Inserts keys [0, 2, 4, ..] with values [0, 1, 2, ..]
+// Then looks up all of [0, 1, 2, ...] in one batch
+// Checks even keys are found with value i/2, and odd keys are not
+
+#include <iostream>
+#include <vector>
+#include "unordered_map.h"
+
+int main() {
+  long n = 100000;
+  parlay::parlay_unordered_map<long, long> map(n);
+  for (long i = 0; i < n; i++)
+    map.Insert(2*i, i);
+
+  std::vector<long> keys(2*n);
+  for (long i = 0; i < 2*n; i++) keys[i] = i;
+  std::vector<std::optional<long>> out(2*n);
+  map.FindBatch(keys, out);
+
+  for (long i = 0; i < 2*n; i++) {
+    if (out[i].has_value() != (i % 2 == 0) || (out[i].has_value() && *out[i] != i/2)) {
+      std::cout << "error at: " << i << std::endl;
+      abort();
+    }
+  }
+  std::cout << "OK" << std::endl;
+}
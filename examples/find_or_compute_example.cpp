@@ -0,0 +1,43 @@
+// Example of using FindOrCompute
+// Uses a map as a cache of the results of an expensive function.
+// Several threads ask for the same keys at once, and FindOrCompute
+// calls the function only once for each key: the first call claims
+// the key and the others wait for its value
+// Checks the values, and that the function ran once per key
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "unordered_map.h"
+
+int main() {
+  long keys = 100;
+  int p = 4;
+  parlay::parlay_unordered_map<long, long> cache(keys);
+  std::atomic<long> calls = 0;
+  auto slow_square = [&] (long k) {
+    calls++;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    return k * k;
+  };
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < p; t++)
+    threads.emplace_back([&] {
+      for (long k = 0; k < keys; k++) {
+	long v = cache.FindOrCompute(k, [&] {return slow_square(k);});
+	if (v != k * k) {
+	  std::cout << "error at: " << k << std::endl;
+	  abort();
+	}
+      }});
+  for (auto& th : threads) th.join();
+
+  if (calls != keys || cache.size() != keys) {
+    std::cout << "error: " << calls << " calls for " << keys << " keys" << std::endl;
+    abort();
+  }
+  std::cout << "OK" << std::endl;
+}
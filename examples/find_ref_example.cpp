@@ -0,0 +1,36 @@
+// Example of using FindRef
+// Stores vectors as values, and reads them through the reference
+// returned by FindRef, which does not copy the vector
+// The reference stays valid until the value_ref is destroyed, even if
+// the key is removed (or its value replaced) in the meantime
+// Checks the values read, including one read after its key is removed
+
+#include <iostream>
+#include <vector>
+#include "unordered_map.h"
+
+void check(bool b, const char* what) {
+  if (!b) {
+    std::cout << "error in " << what << std::endl;
+    abort();
+  }
+}
+
+int main() {
+  long n = 1000;
+  parlay::parlay_unordered_map<long, std::vector<long>> map(n);
+  for (long i = 0; i < n; i++) map.Insert(i, std::vector<long>(i, i));
+
+  for (long i = 0; i < n; i++) {
+    auto r = map.FindRef(i);
+    check(r && r.key() == i && (long) r->size() == i, "find_ref");
+    for (long x : *r) check(x == i, "value");
+  }
+  check(!map.FindRef(n), "find_ref of missing key");
+
+  auto held = map.FindRef(7);
+  map.Remove(7);
+  check(held && (*held).size() == 7 && (*held)[6] == 7, "held reference after remove");
+  check(!map.FindRef(7), "find_ref after remove");
+  std::cout << "OK" << std::endl;
+}
@@ -0,0 +1,30 @@
+// Example of using a map with key fingerprints
+// Inserts keys [0, 2, 4, ..] with values [0, 1, 2, ..] into a map that
+// keeps a one byte fingerprint of each key in its bucket
+// Then looks up all of [0, 1, 2, ...], half of which are missing, which
+// is where fingerprints help since most keys need not be compared
+// Checks even keys are found with value i/2, and odd keys are not
+
+#include <iostream>
+#include "unordered_map.h"
+
+int main() {
+  long n = 100000;
+  parlay::parlay_unordered_map_fingerprint<long, long> map(n);
+  for (long i = 0; i < n; i++)
+    map.Insert(2*i, i);
+
+  for (long i = 0; i < 2*n; i++) {
+    auto r = map.Find(i);
+    if (r.has_value() != (i % 2 == 0) || (r.has_value() && *r != i/2)) {
+      std::cout << "error at: " << i << std::endl;
+      abort();
+    }
+  }
+  for (long i = 0; i < n; i += 2) map.Remove(2*i);
+  if (map.size() != n/2) {
+    std::cout << "error: size " << map.size() << " after removes" << std::endl;
+    abort();
+  }
+  std::cout << "OK" << std::endl;
+}
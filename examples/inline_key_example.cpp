@@ -0,0 +1,34 @@
+// Example of using parlay_unordered_map_inline_key
+// The map keeps each key-value pair through a pointer, as an indirect
+// map does, and also a copy of the key next to the pointer in the
+// bucket, so a find only follows the pointer of the key that matches
+// Useful for small keys with large values, which here are strings
+// Checks finds, and that references to values stay valid as the table
+// grows, which they do since the pairs are never moved
+
+#include <iostream>
+#include <string>
+#include "unordered_map.h"
+
+void check(bool b, const char* what) {
+  if (!b) {
+    std::cout << "error in " << what << std::endl;
+    abort();
+  }
+}
+
+int main() {
+  long n = 100000;
+  parlay::parlay_unordered_map_inline_key<long, std::string> map(10);
+  map.Insert(-1, "first");
+  auto first = map.FindRef(-1);
+  for (long i = 0; i < n; i++) map.Insert(i, std::string(50, 'a' + i % 26));
+
+  check(*first == "first", "reference after growing");
+  for (long i = 0; i < n; i++) {
+    auto r = map.Find(i);
+    check(r.has_value() && r->size() == 50 && (*r)[0] == 'a' + i % 26, "find");
+  }
+  check(!map.Find(n).has_value(), "missing key");
+  std::cout << "OK" << std::endl;
+}
@@ -0,0 +1,42 @@
+// Example of using for_each, map_reduce and entries
+// Inserts keys [0, 1, 2, ...] with values [0, 2, 4, ...]
+// Then sums the values with map_reduce, counts the entries with
+// for_each, and gets the keys of entries with odd keys with entries,
+// each of which runs in parallel over the table
+// Checks each result
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <utility>
+#include "unordered_map.h"
+
+void check(bool b, const char* what) {
+  if (!b) {
+    std::cout << "error in " << what << std::endl;
+    abort();
+  }
+}
+
+int main() {
+  long n = 100000;
+  parlay::parlay_unordered_map<long, long> map(n);
+  for (long i = 0; i < n; i++) map.Insert(i, 2*i);
+
+  long sum = map.map_reduce([] (const std::pair<long, long>& kv) {return kv.second;},
+			    parlay::plus<long>());
+  check(sum == n * (n - 1), "map_reduce");
+
+  std::atomic<long> cnt = 0;
+  map.for_each([&] (const std::pair<long, long>& kv) {
+    if (kv.second == 2 * kv.first) cnt++;});
+  check(cnt == n, "for_each");
+
+  auto keys = map.entries([] (const std::pair<long, long>& kv) {
+    return (kv.first % 2 == 1) ? kv.first : -1l;});
+  std::sort(keys.begin(), keys.end());
+  check((long) keys.size() == n, "entries size");
+  for (long i = 0; i < n / 2; i++)
+    check(keys[i] == -1 && keys[n / 2 + i] == 2*i + 1, "entries");
+  std::cout << "OK" << std::endl;
+}
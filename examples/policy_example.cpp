@@ -0,0 +1,36 @@
+// Example of using a policy
+// A policy inherits from parlay::default_hash_policy and redefines
+// the members it changes.  This one uses more memory per entry so
+// buckets stay short, grows when the sampled load gets high rather
+// than only when a bucket overflows, and copies more blocks per
+// update while the table is resized, so a resize finishes sooner
+// Inserts keys [0, 1, 2, ...] into a small map, growing it, and
+// checks all keys are found
+
+#include <iostream>
+#include "unordered_map.h"
+
+struct roomy_policy : parlay::default_hash_policy {
+  static constexpr double space_factor = 3.0;
+  static constexpr double max_load_factor = 0.5;
+  static constexpr long migration_budget = 4;
+};
+
+int main() {
+  long n = 1000000;
+  parlay::parlay_unordered_map<long, long, std::hash<long>, std::equal_to<long>,
+			       roomy_policy> map(100);
+  for (long i = 0; i < n; i++) map.Insert(i, i);
+  for (long i = 0; i < n; i++) {
+    auto r = map.Find(i);
+    if (!r.has_value() || *r != i) {
+      std::cout << "error at: " << i << std::endl;
+      abort();
+    }
+  }
+  if (map.size() != n) {
+    std::cout << "error: size " << map.size() << std::endl;
+    abort();
+  }
+  std::cout << "OK" << std::endl;
+}
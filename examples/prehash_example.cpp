@@ -0,0 +1,53 @@
+// Example of using prehash and heterogeneous lookup
+// With a transparent Hash and Equal, a map with std::string keys can
+// be probed with a std::string_view without constructing a string
+// A key hashed once with prehash can be looked up in several maps with
+// the same Hash, e.g. to find which of them contain it
+// Checks what is found in each map
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include "unordered_map.h"
+
+struct string_hash {
+  using is_transparent = void;
+  size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s);}
+};
+
+struct string_equal {
+  using is_transparent = void;
+  bool operator()(std::string_view a, std::string_view b) const { return a == b;}
+};
+
+using map_type = parlay::parlay_unordered_map<std::string, long, string_hash, string_equal>;
+
+void check(bool b, const char* what) {
+  if (!b) {
+    std::cout << "error in " << what << std::endl;
+    abort();
+  }
+}
+
+int main() {
+  map_type small(10), large(1000);
+  for (long i = 0; i < 1000; i++) {
+    if (i < 10) small.Insert(std::to_string(i), i);
+    large.Insert(std::to_string(i), i);
+  }
+
+  // lookups by string_view
+  std::string_view text = "5 50 500 5000";
+  check(small.Find(text.substr(0, 1)) == std::optional(5l), "string_view in small");
+  check(large.Find(text.substr(2, 2)) == std::optional(50l), "string_view in large");
+  check(!large.contains(text.substr(9, 4)), "missing string_view");
+
+  // one hash for lookups in both maps
+  for (long i = 0; i < 1000; i++) {
+    std::string key = std::to_string(i);
+    auto k = small.prehash(key);
+    check(small.contains(k) == (i < 10), "prehashed key in small");
+    check(large.Find(k) == std::optional(i), "prehashed key in large");
+  }
+  std::cout << "OK" << std::endl;
+}
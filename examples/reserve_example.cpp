@@ -0,0 +1,30 @@
+// Example of using reserve
+// Constructs a small table, reserves space for n entries so the table
+// is grown once, before any inserts, rather than repeatedly while
+// inserting, then inserts keys [0, 1, 2, ...]
+// Checks all keys are found, and that reserving less does nothing
+
+#include <iostream>
+#include "unordered_map.h"
+
+int main() {
+  long n = 1000000;
+  parlay::parlay_unordered_map<long, long> map(1);
+  map.Insert(-1, -1);
+  map.reserve(n);
+  for (long i = 0; i < n; i++) map.Insert(i, 2*i);
+  map.reserve(10);
+
+  if (map.size() != n + 1 || map.Find(-1) != std::optional(-1l)) {
+    std::cout << "error: size " << map.size() << std::endl;
+    abort();
+  }
+  for (long i = 0; i < n; i++) {
+    auto r = map.Find(i);
+    if (!r.has_value() || *r != 2*i) {
+      std::cout << "error at: " << i << std::endl;
+      abort();
+    }
+  }
+  std::cout << "OK" << std::endl;
+}
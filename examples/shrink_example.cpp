@@ -0,0 +1,37 @@
+// Example of shrinking a table
+// Inserts n keys into a map whose policy frees old table versions,
+// then removes all but a few, which lets the table shrink on its own,
+// and calls shrink_to_fit to shrink it the rest of the way
+// Checks the remaining keys are still there
+
+#include <iostream>
+#include "unordered_map.h"
+
+// frees replaced versions of the table, and shrinks it when removes
+// leave it sparse
+struct reclaim_policy : parlay::default_hash_policy {
+  static constexpr bool reclaim_versions = true;
+};
+
+int main() {
+  long n = 1000000;
+  parlay::parlay_unordered_map<long, long, std::hash<long>, std::equal_to<long>,
+			       reclaim_policy> map(1000);
+  for (long i = 0; i < n; i++) map.Insert(i, i);
+  for (long i = 0; i < n; i++)
+    if (i % 1000 != 0) map.Remove(i);
+  map.shrink_to_fit();
+
+  if (map.size() != n / 1000) {
+    std::cout << "error: size " << map.size() << " after shrinking" << std::endl;
+    abort();
+  }
+  for (long i = 0; i < n; i += 1000) {
+    auto r = map.Find(i);
+    if (!r.has_value() || *r != i) {
+      std::cout << "error at: " << i << std::endl;
+      abort();
+    }
+  }
+  std::cout << "OK" << std::endl;
+}
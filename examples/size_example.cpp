@@ -0,0 +1,46 @@
+// Example of using size_estimate and empty
+// With a policy that sets count_size, each thread counts the entries
+// it adds and removes, so size_estimate() and empty() take time
+// proportional to the number of threads rather than the table size
+// Inserts keys [0, 1, 2, ...] from several threads, and then removes
+// them from a different thread than the one that inserted each
+// Checks the estimate is exact once the threads are done
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "unordered_map.h"
+
+struct counting_policy : parlay::default_hash_policy {
+  static constexpr bool count_size = true;
+};
+
+void check(bool b, const char* what) {
+  if (!b) {
+    std::cout << "error in " << what << std::endl;
+    abort();
+  }
+}
+
+int main() {
+  long n = 100000;
+  int p = 4;
+  parlay::parlay_unordered_map<long, long, std::hash<long>, std::equal_to<long>,
+			       counting_policy> map(n);
+  check(map.empty() && map.size_estimate() == 0, "new map");
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < p; t++)
+    threads.emplace_back([&, t] {
+      for (long i = t; i < n; i += p) map.Insert(i, i);});
+  for (auto& th : threads) th.join();
+  check(!map.empty() && map.size_estimate() == n && map.size() == n, "after inserts");
+
+  threads.clear();
+  for (int t = 0; t < p; t++)
+    threads.emplace_back([&, t] {
+      for (long i = (t + 1) % p; i < n; i += p) map.Remove(i);});
+  for (auto& th : threads) th.join();
+  check(map.empty() && map.size_estimate() == 0, "after removes");
+  std::cout << "OK" << std::endl;
+}
@@ -0,0 +1,37 @@
+// Example of using 16 byte buckets
+// A policy with bucket_bytes = 16 gives buckets with a single 8 byte
+// entry, e.g. for a set of longs.  When compiled with cmpxchg16b and
+// AVX (e.g. -march=native) these are updated with a lock-free 16 byte
+// CAS, and otherwise with the usual sequence lock
+// Inserts keys [0, 1, 2, ...] from several threads, then removes the
+// odd ones, and checks which are left
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "unordered_set.h"
+
+struct small_policy : parlay::default_hash_policy {
+  static constexpr long bucket_bytes = 16;
+};
+
+int main() {
+  long n = 100000;
+  int p = 4;
+  parlay::parlay_unordered_set<long, std::hash<long>, std::equal_to<long>,
+			       small_policy> set(n);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < p; t++)
+    threads.emplace_back([&, t] {
+      for (long i = t; i < n; i += p) set.Insert(i);
+      for (long i = t; i < n; i += p) if (i % 2 == 1) set.Remove(i);});
+  for (auto& th : threads) th.join();
+
+  for (long i = 0; i < n; i++) {
+    if (set.contains(i) != (i % 2 == 0)) {
+      std::cout << "error at: " << i << std::endl;
+      abort();
+    }
+  }
+  std::cout << "OK" << std::endl;
+}
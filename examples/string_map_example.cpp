@@ -0,0 +1,44 @@
+// Example of using parlay_string_map
+// Keys of at most 23 characters are stored inline in the buckets, and
+// longer ones in a second map, but both are used the same way, and
+// looked up by std::string_view without constructing a std::string
+// Counts the words of a text with Upsert, and checks the counts
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include "string_map.h"
+
+void check(bool b, const char* what) {
+  if (!b) {
+    std::cout << "error in " << what << std::endl;
+    abort();
+  }
+}
+
+int main() {
+  std::string text;
+  for (int i = 0; i < 1000; i++)
+    text += "the quick brown fox jumps over the lazy dog and a "
+      "pneumonoultramicroscopicsilicovolcanoconiosis ";
+
+  parlay::parlay_string_map<long> counts(100);
+  std::string_view rest = text;
+  while (!rest.empty()) {
+    size_t end = rest.find(' ');
+    counts.Upsert(rest.substr(0, end), [] (const std::optional<long>& c) {
+      return c.has_value() ? *c + 1 : 1l;});
+    rest.remove_prefix(end + 1);
+  }
+
+  check(counts.size() == 11, "number of words");
+  check(counts.Find("the") == std::optional(2000l), "short word");
+  check(counts.Find("pneumonoultramicroscopicsilicovolcanoconiosis") == std::optional(1000l),
+	"long word");
+  check(!counts.contains("cat"), "missing word");
+  std::atomic<long> total = 0; // for_each runs in parallel
+  counts.for_each([&] (std::string_view, long c) {total += c;});
+  check(total == 12000, "total");
+  std::cout << "OK" << std::endl;
+}
@@ -0,0 +1,48 @@
+// Example of using the Try operations
+// TryInsert, TryUpsert, TryRemove and TryFind give up after a given
+// number of attempts that fail because of other updates to the bucket
+// (or a resize copying it), so a caller can do something else rather
+// than wait.  Here threads that fail to increment a hot counter count
+// the increment in a local total instead, and add it later
+// Checks the results of the Try operations and the final counts
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "unordered_map.h"
+
+void check(bool b, const char* what) {
+  if (!b) {
+    std::cout << "error in " << what << std::endl;
+    abort();
+  }
+}
+
+int main() {
+  long n = 100000;
+  int p = 4;
+  parlay::parlay_unordered_map<long, long> map(100);
+
+  auto r = map.TryInsert(1, 10, 1);
+  check(r && !r->has_value(), "try_insert of new key");
+  r = map.TryInsert(1, 20, 1);
+  check(r && **r == 10, "try_insert of existing key");
+  auto f = map.TryFind(1, 1);
+  check(f && **f == 10, "try_find");
+  r = map.TryRemove(1, 1);
+  check(r && **r == 10 && !map.contains(1), "try_remove");
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < p; t++)
+    threads.emplace_back([&] {
+      long deferred = 0;
+      auto add = [] (long d) {
+	return [d] (const std::optional<long>& v) {return v.value_or(0) + d;};};
+      for (long i = 0; i < n; i++)
+	if (!map.TryUpsert(0, add(1), 2)) deferred++;
+      if (deferred > 0) map.Upsert(0, add(deferred));});
+  for (auto& th : threads) th.join();
+
+  check(map.Find(0) == std::optional(p * n), "final count");
+  std::cout << "OK" << std::endl;
+}
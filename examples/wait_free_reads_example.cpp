@@ -0,0 +1,46 @@
+// Example of using wait_free_reads
+// With a policy that sets wait_free_reads, each bucket points to an
+// immutable copy of its contents that updates replace, so finds never
+// wait for an update in progress, even one by a descheduled thread
+// Runs finds on a fixed set of keys while other threads keep updating
+// other keys in the same buckets, and checks every find succeeds
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "unordered_map.h"
+
+struct wait_free_policy : parlay::default_hash_policy {
+  static constexpr bool wait_free_reads = true;
+};
+
+int main() {
+  long n = 10000;
+  int p = 4;
+  parlay::parlay_unordered_map<long, long, std::hash<long>, std::equal_to<long>,
+			       wait_free_policy> map(n);
+  for (long i = 0; i < n; i++) map.Insert(2*i, i);
+
+  std::atomic<bool> done = false;
+  std::vector<std::thread> updaters;
+  for (int t = 0; t < p - 1; t++)
+    updaters.emplace_back([&, t] {
+      while (!done)
+	for (long i = t; i < n; i += p - 1) {
+	  map.Insert(2*i + 1, i);
+	  map.Remove(2*i + 1);
+	}});
+
+  for (int r = 0; r < 10; r++)
+    for (long i = 0; i < n; i++) {
+      auto v = map.Find(2*i);
+      if (!v.has_value() || *v != i) {
+	std::cout << "error at: " << 2*i << std::endl;
+	abort();
+      }
+    }
+  done = true;
+  for (auto& th : updaters) th.join();
+  std::cout << "OK" << std::endl;
+}
@@ -5,7 +5,21 @@
 //  - Blocking stores
 //  - Blocking CAS
 //
-// No additional space usage
+// The version word is also used as the lock for writers, so there is
+// no additional space usage, and updates to different big_atomics
+// never contend.
+//
+// Values of exactly 16 bytes instead use a 16 byte CAS (cmpxchg16b)
+// when compiled for x86-64 with it and AVX enabled (e.g. -mcx16 -mavx
+// or -march=native), which is lock-free and needs no version word.
+// Loads are then plain 16 byte loads, which AVX guarantees are atomic.
+//
+// try_ll is an ll that gives up rather than wait for a write in
+// progress, for callers that bound how long they wait.
+//
+// indirect_atomic is an alternative with the same interface in which
+// loads never wait, even if a writer is descheduled in the middle of
+// an update, at the cost of an allocation per update.
 //
 
 #ifndef PARLAYATOMIC_H_
@@ -13,13 +27,24 @@
 
 #include <atomic>
 #include <functional>
+#include <optional>
 #include <parlay/primitives.h>
 #include <parlay/sequence.h>
-#include <utils/lock.h>
+#include <utils/backoff.h>
+#include <utils/epoch.h>
+
+// Without AVX the only atomic 16 byte read is a cmpxchg16b, which
+// writes the cache line on every read, so the sequence lock is used.
+#if defined(__x86_64__) && defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16) && defined(__AVX__)
+#define PARLAY_BIG_ATOMIC_CAS16
+#include <cstring>
+#include <type_traits>
+#include <emmintrin.h>
+#endif
 
 namespace parlay {
 
-template<typename V, class KeyEqual = std::equal_to<V>>
+template<typename V, class KeyEqual = std::equal_to<V>, typename Enable = void>
 struct alignas(32) big_atomic {
 
   using vtype = long;
@@ -34,11 +59,13 @@ struct alignas(32) big_atomic {
   void store_sequential(const V& v) { val = v; }
   
   V load() {
+    backoff bk(100, 1000);
     while (true) {
       vtype ver = version.load(std::memory_order_acquire);
       V v = val;
       std::atomic_thread_fence(std::memory_order_acquire);
       if ((ver & 1) == 0 && version.load(std::memory_order_relaxed) == ver) return v;
+      bk.pause();
     }
   }
 
@@ -49,46 +76,169 @@ struct alignas(32) big_atomic {
     return std::pair(v, ver);
   }
 
+  // Waits while a write is in progress, yielding if it takes long
+  // since the writer might have been descheduled.
   std::pair<V,tag> ll() {
+    backoff bk(100, 1000);
     while (true) {
-      int delay = 100;
       vtype ver = version.load(std::memory_order_acquire);
       V v = val;
       std::atomic_thread_fence(std::memory_order_acquire);
       if ((ver & 1) == 0 && version.load(std::memory_order_relaxed) == ver)
 	return std::pair(v,ver);
-      for (volatile int i = 0; i < delay; i++);
-      delay = std::min(2 * delay, 1000);
+      bk.pause();
     }
   }
 
+  // Like ll, but makes a single attempt, and returns nullopt if a
+  // write is in progress (or finished during the attempt).
+  std::optional<std::pair<V,tag>> try_ll() {
+    vtype ver = version.load(std::memory_order_acquire);
+    V v = val;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if ((ver & 1) == 0 && version.load(std::memory_order_relaxed) == ver)
+      return std::pair(v,ver);
+    return std::nullopt;
+  }
+
   bool lv(tag tg) {
     return version.load() == tg;
   }
 
+  // The version is also the lock: a writer takes it by moving it from
+  // the expected (even) tag to odd, which marks a write in progress,
+  // and releases it by moving it to the next even value.  Fails if
+  // another write has started since the ll.
   bool sc(tag expected_tag, const V& v) {
-    bool result = true;
-    int delay = 100;
-    while (true) {
-      vtype ver = version.load();
-      if (ver != expected_tag) return false;
-      if (get_locks().try_lock((long)this, [&] {
-            if (version.load(std::memory_order_acquire) != expected_tag)
-              result = false;
-            else {
-              version.store(ver + 1, std::memory_order_relaxed);
-              std::atomic_thread_fence(std::memory_order_release);
-              val = v;
-              version.store(ver + 2, std::memory_order_release);
-            }
-            return true;
-          }))
-        return result;
-      for (volatile int i = 0; i < delay; i++);
-      delay = std::min(2 * delay, 2000);
-    }
+    vtype ver = expected_tag;
+    if (version.load(std::memory_order_relaxed) != ver ||
+	!version.compare_exchange_strong(ver, ver + 1, std::memory_order_acquire))
+      return false;
+    std::atomic_thread_fence(std::memory_order_release);
+    val = v;
+    version.store(ver + 2, std::memory_order_release);
+    return true;
+  }
+
+};
+
+#ifdef PARLAY_BIG_ATOMIC_CAS16
+// Lock-free version for 16 byte values.  The tag returned by ll is
+// the value itself, so an sc succeeds if the value is unchanged, even
+// if it was changed and changed back in between.  This is safe for
+// the hash table since old lists and entries cannot be reclaimed, and
+// hence their addresses cannot be reused, while an operation that
+// might still reference them is in its epoch.
+template<typename V, class KeyEqual>
+struct alignas(16) big_atomic<V, KeyEqual,
+			      std::enable_if_t<sizeof(V) == 16 &&
+					       std::is_trivially_copy_constructible_v<V> &&
+					       std::is_trivially_destructible_v<V>>> {
+  using tag = V;
+
+  union { V val; __int128 bits; };
+
+  big_atomic(const V& v) : val(v) {}
+  big_atomic() : val() {}
+
+  static __int128 to_bits(const V& v) {
+    __int128 x;
+    std::memcpy(&x, &v, 16);
+    return x;
+  }
+
+  static V from_bits(__int128 x) {
+    V v;
+    std::memcpy(&v, &x, 16);
+    return v;
+  }
+
+  __int128 load_bits() {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    __int128 x = (__int128) _mm_load_si128((const __m128i*) &bits);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    return x;
+  }
+
+  void store_sequential(const V& v) { val = v; }
+
+  V load() { return from_bits(load_bits()); }
+
+  std::pair<V,tag> ll_speculative() { return ll(); }
+
+  std::pair<V,tag> ll() {
+    V v = load();
+    return std::pair(v, v);
+  }
+
+  std::optional<std::pair<V,tag>> try_ll() { return ll(); }
+
+  bool lv(const tag& tg) {
+    return load_bits() == to_bits(tg);
+  }
+
+  bool sc(const tag& expected_tag, const V& v) {
+    return __sync_bool_compare_and_swap(&bits, to_bits(expected_tag), to_bits(v));
+  }
+};
+#endif
+
+// The value is kept in an immutable copy, and a writer installs a new
+// copy with a CAS on the pointer to it, so loads are wait-free and
+// updates lock-free.  Replaced copies are reclaimed through the epoch
+// collector, so ll, load and lv must be called within an epoch while
+// other threads can be updating.  The tag returned by ll is the
+// pointer, which cannot be reused while the caller is in its epoch.
+// The initial value is kept inline so initializing needs no
+// allocation.  Must be destroyed (or never initialized and zeroed)
+// to free the current copy.
+template<typename V>
+struct indirect_atomic {
+  using tag = V*;
+
+  std::atomic<V*> ptr;
+  V first;
+
+  // never destroyed, so tables can be destroyed after static pools
+  static epoch::memory_pool<V>& pool() {
+    static epoch::memory_pool<V>* p = new epoch::memory_pool<V>();
+    return *p;
   }
 
+  indirect_atomic(const V& v) : ptr(&first), first(v) {}
+  indirect_atomic() : ptr(&first) {}
+  indirect_atomic(const indirect_atomic&) = delete;
+  ~indirect_atomic() {
+    V* p = ptr.load();
+    if (p != nullptr && p != &first) pool().Delete(p);
+  }
+
+  // only when no other thread is accessing it, so can update in place
+  void store_sequential(const V& v) { *ptr.load(std::memory_order_relaxed) = v; }
+
+  V load() { return *ptr.load(std::memory_order_acquire); }
+
+  std::pair<V,tag> ll_speculative() { return ll(); }
+
+  std::pair<V,tag> ll() {
+    V* p = ptr.load(std::memory_order_acquire);
+    return std::pair(*p, p);
+  }
+
+  std::optional<std::pair<V,tag>> try_ll() { return ll(); }
+
+  bool lv(tag tg) { return ptr.load() == tg; }
+
+  bool sc(tag expected_tag, const V& v) {
+    if (ptr.load(std::memory_order_relaxed) != expected_tag) return false;
+    V* p = pool().New(v);
+    if (ptr.compare_exchange_strong(expected_tag, p)) {
+      if (expected_tag != &first) pool().Retire(expected_tag);
+      return true;
+    }
+    pool().Delete(p); // was never visible to others
+    return false;
+  }
 };
 
 }  // namespace parlay
@@ -0,0 +1,115 @@
+// A concurrent map from keys to counts, in which adding to the count
+// of a key already in the map is a single hardware fetch-and-add.  On
+// a key type K and an integral count type V it supports:
+//
+//   parlay_counter_map<K, V=long, Hash=std::hash<K>, Equal=std::equal_to<K>,
+//     Policy=default_hash_policy>(n, clear_at_end) :
+//   constructor for a map of initial size n.
+//
+//   FetchAdd(const K&, V delta = 1) -> V :
+//   adds delta to the count of the key and returns the count before,
+//   or if the key is not in the map, inserts it with count delta and
+//   returns 0.
+//
+//   Find(const K&) -> std::optional<V>
+//   Remove(const K&) -> std::optional<V>
+//   contains(const K&) -> bool
+//   size() -> long, empty() -> bool, clear() -> void
+//   for_each(F f) : applies f(const K&, V) to each entry
+//
+// with the same meaning as for parlay_unordered_map.
+//
+// Counts are kept in an std::atomic<V> reached through a pointer from
+// the bucket, so adding to an existing count does not update the
+// bucket (as an Upsert on a parlay_unordered_map does), and adds to
+// different keys of a bucket do not conflict.  The count is only
+// reached within an epoch, so it is not freed while being added to.
+// Trivially copyable keys also have a copy kept in the bucket (as
+// with parlay_unordered_map_inline_key), so finding one only follows
+// the pointer of the key that matches.
+//
+// A FetchAdd that runs concurrently with a Remove of the same key
+// might be applied to the removed count, and hence lost.  All other
+// operations are linearizable.
+
+#ifndef PARLAY_COUNTER_MAP_
+#define PARLAY_COUNTER_MAP_
+
+#include <atomic>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "parlay_hash.h"
+
+namespace parlay {
+
+  // entries contain a key and an atomic count
+  template <typename K_, typename V_, class Hash_ = std::hash<K_>, class KeyEqual_ = std::equal_to<K_>>
+  struct CounterData {
+    using K = K_;
+    using V = V_;
+    using Hash = Hash_;
+    using KeyEqual = KeyEqual_;
+    using value_type = std::pair<K, std::atomic<V>>;
+    static const K& get_key(const value_type& x) { return x.first;}
+  };
+
+  template <typename K, typename V = long, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>,
+	    class Policy = default_hash_policy>
+  struct parlay_counter_map {
+    static_assert(std::is_integral_v<V>, "counts must be integral");
+    using Data = CounterData<K, V, Hash, KeyEqual>;
+    using Entries = std::conditional_t<std::is_trivially_copyable_v<K>,
+				       InlineKeyEntries<Data>, IndirectEntries<Data>>;
+    using map = parlay_hash<Entries, Policy>;
+    using Entry = typename Entries::Entry;
+    using key_type = K;
+    using mapped_type = V;
+
+    Entries entries_;
+    map m;
+
+    static constexpr auto true_f = [] (const Entry&) {return true;};
+    static constexpr auto get_count = [] (const Entry& e) -> V {
+      return e.get_entry().second.load();};
+
+    parlay_counter_map(long n, bool clear_at_end = default_clear_at_end)
+      : entries_(Entries(clear_at_end)),
+	m(map(n, &entries_, clear_at_end)) {}
+
+    // The add is applied by the function passed to Find or Insert,
+    // which is run in the same epoch the entry is found in.
+    V FetchAdd(const K& key, V delta = 1) {
+      auto k = Entry::make_key(key);
+      auto add = [&] (const Entry& e) -> V {
+	return e.get_entry().second.fetch_add(delta);};
+      std::optional<V> r = m.Find(k, add);
+      if (r.has_value()) return *r;
+      r = m.Insert(k, [&] {return entries_.emplace_entry(k, key, delta);}, add);
+      return r.has_value() ? *r : V{};
+    }
+
+    std::optional<V> Find(const K& key) {
+      return m.Find(Entry::make_key(key), get_count);}
+
+    bool contains(const K& key) {
+      return m.Find(Entry::make_key(key), true_f).has_value();}
+
+    std::optional<V> Remove(const K& key) {
+      return m.Remove(Entry::make_key(key), get_count);}
+
+    long size() { return m.size();}
+    bool empty() { return m.empty();}
+    void clear() { m.clear_buckets();}
+
+    template <typename F>
+    void for_each(const F& f) {
+      m.for_each([&] (const Entry& e) {
+	auto& kv = e.get_entry();
+	f(kv.first, kv.second.load());});
+    }
+  };
+
+}  // namespace parlay
+#endif  // PARLAY_COUNTER_MAP_
@@ -7,13 +7,41 @@ namespace parlay {
 
   using scheduler_type = internal::scheduler_type;
 
+  template <typename F>
+  void parallel_for(long n, const F& f) {
+    parlay::parallel_for(0, n, f);
+  }
+
+  template <typename T, typename Less>
+  void parallel_sort(std::vector<T>& a, const Less& less) {
+    parlay::sort_inplace(a, less);
+  }
+
   template <typename F>
   long tabulate_reduce(long n, const F& f) {
     return parlay::reduce(parlay::delayed::tabulate(n, [&] (size_t i) {
 	     return f(i);}));
   }
+
+  // reduces f(0), ..., f(n-1) with the monoid m, which has an
+  // identity member and a binary operator
+  template <typename F, typename Monoid>
+  auto tabulate_reduce(long n, const F& f, const Monoid& m) {
+    return parlay::reduce(parlay::delayed::tabulate(n, [&] (size_t i) {
+	     return f(i);}), m);
+  }
+
+  // f(i) returns a sequence, and these are concatenated for 0 <= i < n
+  template <typename F>
+  auto tabulate_flatten(long n, const F& f) {
+    return parlay::flatten(parlay::tabulate(n, [&] (size_t i) {
+	     return f(i);}));
+  }
 }
 #else
+#include <algorithm>
+#include <type_traits>
+#include <vector>
 namespace parlay {
 
   struct scheduler_type {
@@ -28,9 +56,29 @@ namespace parlay {
     return r;
   }
   
+  template <typename F, typename Monoid>
+  auto tabulate_reduce(long n, const F& f, const Monoid& m) {
+    std::remove_cv_t<decltype(m.identity)> r = m.identity;
+    for (long i=0; i < n; i++)
+      r = m(r, f(i));
+    return r;
+  }
+
   template <typename F>
   void parallel_for(long n, const F& f) {
     for (long i=0; i < n; i++) f(i);
   }
+
+  template <typename F>
+  auto tabulate_flatten(long n, const F& f) {
+    std::invoke_result_t<F, long> r;
+    for (long i=0; i < n; i++) r.append(f(i));
+    return r;
+  }
+
+  template <typename T, typename Less>
+  void parallel_sort(std::vector<T>& a, const Less& less) {
+    std::sort(a.begin(), a.end(), less);
+  }
 }
 #endif
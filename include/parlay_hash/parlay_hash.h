@@ -2,10 +2,14 @@
 #define PARLAY_HASH_H_
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <functional>
 #include <iterator>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <thread>
 #include <tuple>
@@ -13,6 +17,11 @@
 #include <utility>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <utils/backoff.h>
 #include <utils/epoch.h>
 #include "bigatomic.h"
 #include "parallel.h"
@@ -21,32 +30,63 @@ constexpr bool PrintGrow = false;
 
 namespace parlay {
 
+// An Entries type can ask for each bucket to keep a fingerprint of
+// each key in its buffer by defining fingerprints = true.
+template <typename Entries, typename = void>
+struct uses_fingerprints : std::false_type {};
+
 template <typename Entries>
-struct parlay_hash {
-  using Entry = typename Entries::Entry;
-  using K = typename Entry::Key;
+struct uses_fingerprints<Entries, std::void_t<decltype(Entries::fingerprints)>>
+  : std::bool_constant<Entries::fingerprints> {};
+
+// Returned by the Try operations, which give up after a bounded
+// number of attempts on a contended bucket rather than retry until
+// they succeed.  Converts to false if the operation gave up, and
+// otherwise * gives what the operation without Try would return.
+template <typename T>
+struct try_result {
+  bool done = false;
+  T result{};
+  explicit operator bool() const { return done;}
+  bool contended() const { return !done;}
+  const T& operator*() const { return result;}
+  T& operator*() { return result;}
+  const T* operator->() const { return &result;}
+};
 
-  // *********************************************
-  // Various parameters
-  // *********************************************
-  
-  // set to grow by factor of 8 (2^3)
+// The parameters that control the size of a parlay_hash, and when
+// and how it grows and shrinks.  A different policy can be passed as
+// a template argument, e.g. to trade memory for speed.  A policy can
+// inherit from this one and redefine just the members it changes.
+struct default_hash_policy {
+  // set to grow by factor of 4 (2^2)
   static constexpr int log_grow_factor = 2;
-  static constexpr int grow_factor = 1 << log_grow_factor;
+
+  // A table constructed for n entries, or reserved for them, has
+  // space_factor * n / 2^log_bucket_size buckets, rounded up to a
+  // power of two.  Larger is faster, but uses more memory.
+  static constexpr double space_factor = 1.5;
+
+  // log_2 of the expected number of entries in a bucket, given the
+  // number that fit in the buffer of a bucket (<= buffer_size)
+  static constexpr long log_bucket_size(long buffer_size) {
+    return (buffer_size == 1) ? 0 : ((buffer_size == 2) ? 1 : ((buffer_size <= 4) ? 2 : 3));
+  }
 
   // groups of block_size buckets are copied over by a single thread
-  // the block size typically grows with size, but starts here
+  // the block size is small so each copy is short, but starts here
   static constexpr long min_block_size = 4;
+  static long block_size(int /* num_bits */) { return 16; }
 
-  // buffer_size is picked so state fits in a cache line (if it can)
-  static constexpr long buffer_size = (sizeof(Entry) > 24) ? 1 : 48 / sizeof(Entry);
-
-  // log_2 of the expected number of entries in a bucket (<= buffer_size)
-  static constexpr long log_bucket_size = 
-    (buffer_size == 1) ? 0 : ((buffer_size == 2) ? 1 : ((buffer_size <= 4) ? 2 : ((buffer_size <= 8) ? 3 : 3)));
+  // While a resize is in progress, each update copies at most this
+  // many blocks: its own if not yet copied, and otherwise others
+  // nearby.  This bounds the extra latency of an update, while
+  // ensuring copying progresses even if updates are concentrated.
+  static constexpr long migration_budget = 1;
 
-  static long get_block_size(int num_bits) {
-    return num_bits < 16 ? 16 : 256; }
+  // The number of blocks after its own an update looks at for
+  // uncopied blocks to help with.
+  static constexpr long help_scan_limit = 16;
 
   // The size of a bucket that causes the table to grow, i.e. if any
   // insert causes the bucket to reach the given size, then start
@@ -54,14 +94,122 @@ struct parlay_hash {
   // Technically this should be something like c log (n) / log(log n))
   // for a small constant c if each bucket is expected to hold 1
   // element, but.... each bucket can be expected to hold more than one.
-  static long get_overflow_size(int num_bits) {
-    if constexpr (log_bucket_size == 0) return num_bits < 18 ? 10 : 16;
-    else if constexpr (log_bucket_size == 1) return num_bits < 18 ? 11 : 18;
-    else if constexpr (log_bucket_size == 2) return num_bits < 18 ? 12 : 20;
-    else if constexpr (log_bucket_size == 3) return num_bits < 18 ? 14 : 22;
+  static long overflow_size(int num_bits, long log_bucket_size) {
+    if (log_bucket_size == 0) return num_bits < 18 ? 10 : 16;
+    else if (log_bucket_size == 1) return num_bits < 18 ? 11 : 18;
+    else if (log_bucket_size == 2) return num_bits < 18 ? 12 : 20;
+    else if (log_bucket_size == 3) return num_bits < 18 ? 14 : 22;
     else return num_bits < 18 ? 20 : 24;
   }
 
+  // If positive, the table also grows when the load, estimated from
+  // a sample of buckets taken by a small fraction of inserts, exceeds
+  // max_load_factor.  The load is the number of entries over the
+  // number of buckets times 2^log_bucket_size, and is 1/space_factor
+  // for a newly constructed table, so this should be well above that.
+  // If zero, growth is only triggered by a bucket reaching overflow_size.
+  static constexpr double max_load_factor = 0.0;
+
+  // If set, each thread keeps a count of the entries it has added
+  // less those it has removed, so size_estimate() and empty() take
+  // time proportional to the number of threads rather than the size
+  // of the table.  Costs an update of a thread-local counter on each
+  // successful insert or remove.
+  static constexpr bool count_size = false;
+
+  // The number of bytes taken by a bucket, 16, 32 or a multiple of the
+  // 64 byte cache line.  The buffer of a bucket holds as many entries
+  // as fit, so larger buckets keep more entries out of the overflow
+  // lists, which helps for large entries (e.g. 32-48 bytes fit just
+  // one entry in 64 bytes, but 2-3 in 128).  Lookups that go past the
+  // first line of a bucket pay for the next ones, but these are
+  // adjacent.  A 16 byte bucket holds one 8 byte entry (e.g. for a set
+  // of longs) and is updated with a lock-free 16 byte CAS when compiled
+  // with cmpxchg16b and AVX (e.g. -march=native), otherwise with the
+  // usual sequence lock (see bigatomic.h).
+  static constexpr long bucket_bytes = 64;
+
+  // If set, each bucket holds a pointer to an immutable copy of its
+  // state that updates replace (see indirect_atomic in bigatomic.h),
+  // so finds never wait for an update that is in progress, even if
+  // the updating thread is descheduled.  Costs an allocation per
+  // update, and 8 bytes of each bucket.
+  static constexpr bool wait_free_reads = false;
+
+  // If positive, an update that has failed this many times on a
+  // bucket (because other updates changed it first) publishes itself
+  // to a combining slot shared by nearby buckets, and whichever
+  // thread holds the slot applies all the published updates on a
+  // bucket with a single store-conditional, handing each its result.
+  // Under heavy skew this replaces many failed retries with one
+  // update, but it makes the contended updates blocking (they wait
+  // for the combiner).  Zero turns it off.
+  static constexpr int combine_after = 0;
+
+  // If set, the table versions replaced by a resize are freed once no
+  // operation can still be reading them, and the table shrinks on its
+  // own when removes leave it sparse.  This needs every Find to enter
+  // an epoch.  Otherwise replaced versions are kept until the table is
+  // cleared or destroyed, which costs at most the size of the current
+  // version while it only grows, and finds on direct entries read a
+  // bucket's buffer without entering an epoch.
+  static constexpr bool reclaim_versions = false;
+};
+
+template <typename Entries, typename Policy = default_hash_policy>
+struct parlay_hash {
+  using Entry = typename Entries::Entry;
+  using K = typename Entry::Key;
+
+  // *********************************************
+  // Various parameters
+  // *********************************************
+  // Most are taken from the Policy, see default_hash_policy.
+
+  static constexpr int log_grow_factor = Policy::log_grow_factor;
+  static constexpr int grow_factor = 1 << log_grow_factor;
+  static constexpr long min_block_size = Policy::min_block_size;
+  static constexpr long migration_budget = Policy::migration_budget;
+  static constexpr long help_scan_limit = Policy::help_scan_limit;
+  static constexpr bool combining = Policy::combine_after > 0;
+
+  // Finds (and a first attempt at a remove) on direct entries can
+  // read a bucket without entering an epoch as long as neither the
+  // table versions nor the states of buckets are ever freed.
+  static constexpr bool epoch_free_reads =
+    Entry::Direct && !Policy::reclaim_versions && !Policy::wait_free_reads;
+
+  // If set, each state keeps an 8-bit fingerprint of the hash of each
+  // key in its buffer, which are all compared at once on a lookup so
+  // that only keys with matching fingerprints need to be compared.
+  static constexpr bool use_fingerprints = uses_fingerprints<Entries>::value;
+
+  // buffer_size is picked so a bucket fits in Policy::bucket_bytes (if
+  // it can).  The list head and the version of the big_atomic take 16
+  // bytes, or just 8 for the list head in a 16 byte bucket since it is
+  // updated with a 16 byte CAS and has no version.  The fingerprints
+  // take 8 more, so at most 8 entries fit with them.
+  static_assert(Policy::bucket_bytes == 16 || Policy::bucket_bytes == 32 ||
+		(Policy::bucket_bytes % 64 == 0 && Policy::bucket_bytes > 0),
+		"bucket_bytes must be 16, 32 or a multiple of 64");
+  static constexpr long buffer_bytes =
+    Policy::bucket_bytes - ((Policy::bucket_bytes == 16) ? 8 : 16);
+  static constexpr long buffer_size =
+    use_fingerprints ? std::max<long>(1, std::min<long>(8, (buffer_bytes - 8) / sizeof(Entry)))
+    : std::max<long>(1, buffer_bytes / sizeof(Entry));
+  // the count in the list head is 8 bits and goes up to buffer_size+1
+  static_assert(buffer_size < 255,
+		"bucket_bytes too large: at most 254 entries fit in a bucket's buffer");
+
+  // log_2 of the expected number of entries in a bucket (<= buffer_size)
+  static constexpr long log_bucket_size = Policy::log_bucket_size(buffer_size);
+
+  static long get_block_size(int num_bits) {
+    return Policy::block_size(num_bits); }
+
+  static long get_overflow_size(int num_bits) {
+    return Policy::overflow_size(num_bits, log_bucket_size); }
+
   // clear_at_end will cause the scheduler and epoch-based collector
   // to clear their state on destruction
   static constexpr bool default_clear_at_end = true;
@@ -88,39 +236,65 @@ struct parlay_hash {
     return link_pool->New(entry, l); }
   void retire_link(link* l) { link_pool->Retire(l);}
 
+  // the fingerprint of a key is the top byte of its hash, which is
+  // not used by the index
+  template <typename Q>
+  static unsigned char fingerprint(const Q& k) {
+    return Entry::hash(k) >> 56; }
+
+  struct with_fingerprints { size_t fingerprints; };
+  struct without_fingerprints {};
+
   // Each bucket contains a "state", which consists of a fixed size
   // buffer of entries (buffer_size) and an overflow list.  The first
   // buffer_size entries in the bucket are kept in the buffer, and any
   // overflow goes to the list.  The head stores both the pointer to
   // the overflow list (lower 56 bits) and the number of elements in
   // the buffer, or buffer_size+1 if overfull (top 8 bits).
-  struct state {
+  // If use_fingerprints is set, the base holds byte i of fingerprints,
+  // which is the fingerprint of the key in buffer[i].
+  struct state : std::conditional_t<use_fingerprints, with_fingerprints, without_fingerprints> {
   public:
     size_t list_head;
     Entry buffer[buffer_size];
     state() : list_head(0) {}
     state(const Entry& e) : list_head(1ul << 48) {
-      buffer[0] = e;
+      set_entry(0, e);
     }
     static constexpr size_t forwarded_val = 1ul;
     
     size_t make_head(link* l, size_t bsize) {
       return (((size_t) l) | (bsize << 48)); }
 
+    // copies the first n entries of the buffer of s (and their fingerprints)
+    void copy_buffer(const state& s, long n) {
+      for (int i=0; i < n; i++)
+	buffer[i] = s.buffer[i];
+      if constexpr (use_fingerprints) this->fingerprints = s.fingerprints;
+    }
+
+    // sets buffer[i] to e, and its fingerprint
+    void set_entry(int i, const Entry& e) {
+      buffer[i] = e;
+      if constexpr (use_fingerprints) {
+	size_t mask = 255ul << (8 * i);
+	this->fingerprints = ((this->fingerprints & ~mask) |
+			      (((size_t) fingerprint(e.get_key())) << (8 * i)));
+      }
+    }
+
     // update overflow list with new ptr (assumes buffer is full)
     state(const state& s, link* ptr)
       : list_head(make_head(ptr, buffer_size + (ptr != nullptr))) {
-      for (int i=0; i < buffer_size; i++)
-	buffer[i] = s.buffer[i];
+      copy_buffer(s, buffer_size);
     }
 
     // add entry to the bucket state (in buffer if fits, otherwise at head of overflow list)
     template <typename NL>
     state(const state& s, Entry e, const NL& new_link) {
-      for (int i=0; i < std::min(s.buffer_cnt(), buffer_size); i++) 
-	buffer[i] = s.buffer[i];
+      copy_buffer(s, std::min(s.buffer_cnt(), buffer_size));
       if (s.buffer_cnt() < buffer_size) {
-	buffer[s.buffer_cnt()] = e;
+	set_entry(s.buffer_cnt(), e);
 	list_head = make_head(nullptr, s.buffer_cnt() + 1);
       } else {
 	link* l = new_link(e, s.overflow_list());
@@ -130,31 +304,39 @@ struct parlay_hash {
 
     // add entry to buffer (assumes it fits) -- specialization of above
     state(const state& s, Entry e) : list_head(make_head(nullptr, s.buffer_cnt() + 1)) {
-      for (int i=0; i < s.buffer_cnt(); i++) 
-	buffer[i] = s.buffer[i];
-      buffer[s.buffer_cnt()] = e;
+      copy_buffer(s, s.buffer_cnt());
+      set_entry(s.buffer_cnt(), e);
     }
 
     // remove buffer entry j, replace with first from overflow list (assumes there is overflow)
     state(const state& s, link* ptr, int j)
       : list_head(make_head(ptr->next, buffer_size + (ptr->next != nullptr))) {
-      for (int i=0; i < buffer_size; i++)
-	buffer[i] = s.buffer[i];
-      buffer[j] = Entry{ptr->entry};
+      copy_buffer(s, buffer_size);
+      set_entry(j, ptr->entry);
     }
 
     // remove buffer entry j, replace with last entry in buffer (assumes no overflow)
     state(const state& s, int j) : list_head(make_head(nullptr, s.buffer_cnt() - 1)) {
       if (s.overflow_list() != nullptr) abort();
-      for (int i=0; i < s.buffer_cnt(); i++)
-	buffer[i] = s.buffer[i];
-      buffer[j] = buffer[s.buffer_cnt() - 1];
+      copy_buffer(s, s.buffer_cnt());
+      set_entry(j, buffer[s.buffer_cnt() - 1]);
     }
 
     state(bool x) : list_head(forwarded_val) {}
     
     bool is_forwarded() const {return list_head == forwarded_val ;}
 
+    // A frozen state is one whose bucket is being merged into a
+    // smaller version.  It keeps its entries, so it can still be read,
+    // but must not be updated until it is forwarded.
+    static constexpr size_t frozen_bit = 1ul << 63;
+    bool is_frozen() const {return (list_head & frozen_bit) != 0;}
+    state frozen() const {
+      state r = *this;
+      r.list_head |= frozen_bit;
+      return r;
+    }
+
     // number of entries in buffer, or buffer_size+1 if overflow
     long buffer_cnt() const {return (list_head >> 48) & 255ul ;}
 
@@ -170,8 +352,8 @@ struct parlay_hash {
   };
 
   // returns std::optional(f(entry)) for entry with given key
-  template <typename F>
-  static auto find_in_list(const link* nxt, const K& k, const F& f) {
+  template <typename Q, typename F>
+  static auto find_in_list(const link* nxt, const Q& k, const F& f) {
     using rtype = typename std::invoke_result<F,Entry>::type;
     long cnt = 0;
     while (nxt != nullptr && !nxt->entry.equal(k)) {
@@ -188,7 +370,8 @@ struct parlay_hash {
   // tail past k.  Returns the number of new nodes that will need to
   // be reclaimed, the head of the new list, and the link that is removed.
   // Returns [0, nullptr, nullptr] if k is not found
-  std::tuple<int, link*, link*> remove_from_list(link* nxt, const K& k) {
+  template <typename Q>
+  std::tuple<int, link*, link*> remove_from_list(link* nxt, const Q& k) {
     if (nxt == nullptr)
       return std::tuple(0, nullptr, nullptr);
     else if (nxt->entry.equal(k))
@@ -259,12 +442,39 @@ struct parlay_hash {
     return len;
   }
 
+  // Returns a bit mask of the positions in the buffer of s whose
+  // fingerprint matches that of k.  Uses a single SSE2 compare when
+  // available.
+  template <typename Q>
+  static unsigned fingerprint_matches(const state& s, const Q& k) {
+    long len = std::min(s.buffer_cnt(), buffer_size);
+    unsigned char fp = fingerprint(k);
+#if defined(__SSE2__)
+    __m128i eq = _mm_cmpeq_epi8(_mm_cvtsi64_si128((long long) s.fingerprints),
+				_mm_set1_epi8((char) fp));
+    unsigned matches = _mm_movemask_epi8(eq);
+#else
+    unsigned matches = 0;
+    for (int i = 0; i < len; i++)
+      if (((s.fingerprints >> (8 * i)) & 255) == fp) matches |= 1u << i;
+#endif
+    return matches & ((1u << len) - 1);
+  }
+
   // Find key if it is in the buffer. Return index.
-  int find_in_buffer(const state& s, const K& k) {
-    long len = s.buffer_cnt();
-    for (long i = 0; i < std::min(len, buffer_size); i++)
-      if (s.buffer[i].equal(k))
-	return i;
+  template <typename Q>
+  static int find_in_buffer(const state& s, const Q& k) {
+    if constexpr (use_fingerprints) {
+      for (unsigned m = fingerprint_matches(s, k); m != 0; m &= m - 1) {
+	int i = __builtin_ctz(m);
+	if (s.buffer[i].equal(k)) return i;
+      }
+    } else {
+      long len = s.buffer_cnt();
+      for (long i = 0; i < std::min(len, buffer_size); i++)
+	if (s.buffer[i].equal(k))
+	  return i;
+    }
     return -1;
   }
 
@@ -283,15 +493,13 @@ struct parlay_hash {
   // Find entry with given key if in the bucket (state).  Return
   // optional of f applied to the entry if found, otherwise
   // std::nullopt.
-  template <typename F>
-  auto find_in_state(const state& s, const K& k, const F& f)
+  template <typename Q, typename F>
+  auto find_in_state(const state& s, const Q& k, const F& f)
     -> std::optional<typename std::invoke_result<F,Entry>::type>
   {
-    long len = s.buffer_cnt();
-    for (long i = 0; i < std::min(len, buffer_size); i++)
-      if (s.buffer[i].equal(k))
-	return std::optional(f(s.buffer[i]));
-    if (len <= buffer_size) return std::nullopt;
+    int i = find_in_buffer(s, k);
+    if (i >= 0) return std::optional(f(s.buffer[i]));
+    if (s.buffer_cnt() <= buffer_size) return std::nullopt;
     return find_in_list(s.overflow_list(), k, f).first;
   }
 
@@ -299,34 +507,78 @@ struct parlay_hash {
   // a big_atomic<x> is sort of like an std::atomic<x> but supports
   // load-linked, store-conditional, and is efficient when the x does
   // not fit in a machine word.
-  using bckt = big_atomic<state>;
+  using bckt = std::conditional_t<Policy::wait_free_reads,
+				  indirect_atomic<state>, big_atomic<state>>;
 
   // used for load-linked, store-conditionals
-  using tag_type = typename big_atomic<state>::tag;
+  using tag_type = typename bckt::tag;
 
   // wrapper to ensure alignment
-  struct alignas(64) bucket { bckt v; };
+  struct alignas(std::min<long>(64, Policy::bucket_bytes)) bucket { bckt v; };
+
+  // prefetches all the cache lines of a bucket
+  static void prefetch_bucket(bckt* b) {
+    for (long i = 0; i < (long) sizeof(bucket); i += 64)
+      __builtin_prefetch((char*) b + i);
+  }
 
   // initialize an uninitialized bucket
   static void initialize(bucket& bck) {
-    new (&bck.v) big_atomic<state>(state());
+    new (&bck.v) bckt(state());
   }
 
   // *********************************************
   // The table structures
-  // Each version increases in size, by grow_factor
+  // Each version increases or decreases in size by grow_factor
   // *********************************************
 
   // status of a block of buckets, used when initializing and when copying to a new version
   enum status : char {Uninit, Initializing, Empty, Working, Done};
 
+  // Counts finished blocks using a combining tree with fan-in
+  // counter_fan_in, so no counter is incremented by more than that
+  // many threads.  A single fetch-and-add would be a bottleneck with
+  // small blocks.
+  static constexpr int counter_fan_in = 16;
+  struct completion_counter {
+    std::vector<long> level_size; // number of children at each level
+    std::vector<long> level_start; // offset of each level in counts
+    std::atomic<int>* counts;
+
+    completion_counter(long n) {
+      long total = 0;
+      for (long m = n; m > 1; m = (m + counter_fan_in - 1) / counter_fan_in) {
+	level_size.push_back(m);
+	level_start.push_back(total);
+	total += (m + counter_fan_in - 1) / counter_fan_in;
+      }
+      counts = (std::atomic<int>*) malloc(sizeof(std::atomic<int>) * std::max<long>(total, 1));
+      parallel_for(total, [&] (long i) { counts[i] = 0;});
+    }
+
+    ~completion_counter() { free(counts); }
+
+    // Marks i as finished.  Returns true for exactly one caller, the
+    // one that finishes the last of the n.
+    bool finish(long i) {
+      for (size_t l = 0; l < level_size.size(); l++) {
+	long parent = i / counter_fan_in;
+	long children = std::min<long>(counter_fan_in, level_size[l] - parent * counter_fan_in);
+	if (++counts[level_start[l] + parent] != children) return false;
+	i = parent;
+      }
+      return true;
+    }
+  };
+
   // A single version of the table.
   // A version includes a sequence of "size" "buckets".
-  // New versions are added as the hash table grows, and each holds a
-  // pointer to the next larger version, if one exists.
+  // New versions are added as the hash table grows or shrinks, and
+  // each holds a pointer to the next version, if one exists.
   struct table_version {
     std::atomic<table_version*> next; // points to next version if created
-    std::atomic<long> finished_block_count; //number of blocks finished copying
+    std::atomic<long> retire_epoch; // epoch when replaced by next, -1 if not yet
+    std::atomic<bool> has_next; // set by the one thread that creates next
     long num_bits;  // log_2 of size
     size_t size; // number of buckets
     long block_size; // size of each block used for copying
@@ -334,49 +586,78 @@ struct parlay_hash {
     bucket* buckets; // sequence of buckets
     //sequence<bucket> buckets; // sequence of buckets
     std::atomic<status>* block_status; // status of each block while copying
+    completion_counter finished_blocks; // blocks finished copying to next
 
     // The index of a key is the highest num_bits of the lowest
     // 48-bits of the hash value.  Using the highest num_bits ensures
     // that when growing, a bucket will go to grow_factor contiguous
     // buckets in the next table.
-    long get_index(const K& k) {
+    template <typename Q>
+    long get_index(const Q& k) {
       size_t h = Entry::hash(k);
       return (h >> (48 - num_bits))  & (size-1u);}
 
-    bckt* get_bucket(const K& k) {
+    template <typename Q>
+    bckt* get_bucket(const Q& k) {
       return &buckets[get_index(k)].v; }
 
+    // log_2 of the number of buckets for a table of size n (an empty
+    // table is sized as for one entry)
+    static long num_bits_for(long n) {
+      n = std::max<long>(n, 1);
+      return std::max<long>((long) std::ceil(std::log2(min_block_size-1)),
+			    (long) std::ceil(std::log2(Policy::space_factor*n)) - log_bucket_size);
+    }
+
     // initial table version, n indicating size
     table_version(long n) 
       : next(nullptr),
-	finished_block_count(0),
-	num_bits(std::max<long>((long) std::ceil(std::log2(min_block_size-1)),
-				(long) std::ceil(std::log2(1.5*n)) - log_bucket_size)),
+	retire_epoch(-1),
+	has_next(false),
+	num_bits(num_bits_for(n)),
 	size(1ul << num_bits),
 	block_size(num_bits < 10 ? min_block_size : get_block_size(num_bits)),
-	overflow_size(get_overflow_size(num_bits))
+	overflow_size(get_overflow_size(num_bits)),
+	finished_blocks(size/block_size)
     {
       //if (PrintGrow) std::cout << "initial size: " << size << std::endl;
-      buckets = (bucket*) malloc(sizeof(bucket)*size);
+      buckets = allocate_buckets(size);
       block_status = (std::atomic<status>*) malloc(sizeof(std::atomic<status>) * size/block_size);
       parallel_for(size, [&] (long i) { initialize(buckets[i]);});
       parallel_for(size/block_size, [&] (long i) { block_status[i] = Empty;});
     }
 
-    // expanded table version copied from smaller version t
-    table_version(table_version* t)
+    // table version with 2^num_bits buckets copied from the version
+    // passed, which is either grow_factor times smaller or larger.
+    table_version(table_version*, long num_bits)
       : next(nullptr),
-	finished_block_count(0),
-	num_bits(t->num_bits + log_grow_factor),
-	size(t->size * grow_factor),
-	block_size(get_block_size(num_bits)),
-	overflow_size(get_overflow_size(num_bits))
+	retire_epoch(-1),
+	has_next(false),
+	num_bits(num_bits),
+	size(1ul << num_bits),
+	block_size(std::min<long>(get_block_size(num_bits), size)),
+	overflow_size(get_overflow_size(num_bits)),
+	finished_blocks(size/block_size)
     {
-      buckets = (bucket*) malloc(sizeof(bucket)*size);
+      buckets = allocate_buckets(size);
       block_status = (std::atomic<status>*) malloc(sizeof(std::atomic<status>) * size/block_size);
+      // initialize block_status for next grow round.  Done here since
+      // the block size can differ from that of t.
+      parallel_for(size/block_size, [&] (long i) { block_status[i] = Empty;});
+    }
+
+    // With wait_free_reads the arrays are zeroed so buckets that were
+    // never initialized (e.g. in a version that was not finished) can
+    // be told apart when destructing them.
+    static bucket* allocate_buckets(size_t n) {
+      if constexpr (Policy::wait_free_reads)
+	return (bucket*) calloc(n, sizeof(bucket));
+      else return (bucket*) malloc(sizeof(bucket)*n);
     }
 
     ~table_version() {
+      if constexpr (Policy::wait_free_reads)
+	parallel_for(size, [&] (long i) { buckets[i].v.~bckt();});
       free(buckets);
       free(block_status);
     }
@@ -385,8 +666,16 @@ struct parlay_hash {
   // the current table version
   std::atomic<table_version*> current_table_version;
 
-  // the initial table version, used for cleanup on destruction
-  table_version* initial_table_version;
+  // the oldest table version that has not been freed, used for
+  // cleanup on destruction
+  std::atomic<table_version*> initial_table_version;
+
+  // taken by the thread freeing old versions
+  std::atomic<bool> freeing_versions = false;
+
+  // the table is not shrunk automatically below its size on
+  // construction or build
+  long min_num_bits;
 
   // *********************************************
   // Functions for expanding the table
@@ -396,43 +685,43 @@ struct parlay_hash {
   // Allocates a new table version and links the old one to it.
   void expand_table(table_version* ht) {
     table_version* htt = current_table_version.load();
-    if (htt->next == nullptr) {
-      long n = ht->size;
-      // if fail on lock, someone else is working on it, so skip
-      get_locks().try_lock((long) ht, [&] {
-	 if (ht->next == nullptr) {
-	   ht->next = new table_version(ht);
-	   //if (PrintGrow)
-	   //  std::cout << "expand to: " << n * grow_factor << std::endl;
-	 }
-	 return true;});
+    if (htt->next == nullptr)
+      new_version(ht, ht->num_bits + log_grow_factor);
+  }
+
+  // Links ht to a new version with 2^num_bits buckets, unless it
+  // already has a next version.
+  void new_version(table_version* ht, long num_bits) {
+    // if fail to set has_next, someone else is creating it, so skip
+    bool expected = false;
+    if (!ht->has_next.load() && ht->has_next.compare_exchange_strong(expected, true)) {
+      ht->next = new table_version(ht, num_bits);
+      if (migrator != nullptr) start_migration();
+      //if (PrintGrow)
+      //  std::cout << "resize to: " << (1l << num_bits) << std::endl;
     }
   }
 
-  // Copies a bucket into grow_factor new buckets.
+  // Copies a bucket into the 2^(next->num_bits - t->num_bits)
+  // buckets it maps to in the next (larger) table version.
   void copy_bucket(table_version* t, table_version* next, long i) {
-    long exp_start = i * grow_factor;
-    // Clear grow_factor buckets in the next table version to put them in.
-    for (int j = exp_start; j < exp_start + grow_factor; j++)
+    long factor = 1l << (next->num_bits - t->num_bits);
+    long exp_start = i * factor;
+    // Clear factor buckets in the next table version to put them in.
+    for (long j = exp_start; j < exp_start + factor; j++)
       initialize(next->buckets[j]); 
-    // copy bucket to grow_factor new buckets in next table version
+    // copy bucket to factor new buckets in next table version
     while (true) {
       // the bucket to copy
       auto [s, tag] = t->buckets[i].v.ll();
 
-      // insert into grow_factor buckets (states) for next larger table
-      state hold[grow_factor];
-      size_t mask = grow_factor-1;
+      // insert into the new buckets, which no one else can access yet
       for_each_in_state(s, [&] (const Entry& entry) {
-	size_t idx = next->get_index(entry.get_key()) & mask;
-       	hold[idx] = state(hold[idx], entry,
-			  [&] (const Entry& e, link* l) {return new_link(e,l);});
+	bckt& b = next->buckets[next->get_index(entry.get_key())].v;
+	b.store_sequential(state(b.load(), entry,
+				 [&] (const Entry& e, link* l) {return new_link(e,l);}));
       });
 
-      // now store the buckets into table
-      for (int j = 0; j < grow_factor; j++)
-	next->buckets[grow_factor * i + j].v.store_sequential(hold[j]);
-
       // try to replace original bucket with forwarded marker
       if (t->buckets[i].v.sc(tag, state(true))) {
 	retire_list(s.overflow_list()); 
@@ -441,7 +730,7 @@ struct parlay_hash {
       
       // If the attempt failed then someone updated bucket in the meantime so need to retry.
       // Before retrying need to clear out already added buckets.
-      for (int j = exp_start; j < exp_start + grow_factor; j++) {
+      for (long j = exp_start; j < exp_start + factor; j++) {
 	state ss = next->buckets[j].v.load();
 	retire_list(ss.overflow_list());
 	next->buckets[j].v.store_sequential(state());
@@ -449,105 +738,397 @@ struct parlay_hash {
     }
   }
 
+  // Called when the table should shrink.  Allocates a version
+  // grow_factor times smaller and links the old one to it, unless it
+  // would have fewer than 2^min_bits buckets.
+  void shrink_table(table_version* ht, long min_bits) {
+    if (ht->next == nullptr && ht->num_bits - log_grow_factor >= min_bits)
+      new_version(ht, ht->num_bits - log_grow_factor);
+  }
+
+  // Copies the 2^(t->num_bits - next->num_bits) buckets of t that map
+  // to bucket j of the next (smaller) version into it.  Each of them
+  // is first frozen, which stops updates (they wait for it to be
+  // forwarded), but not finds.  The merged bucket is therefore built
+  // from states that cannot change, and is in place before any of
+  // them is forwarded to it.
+  void merge_buckets(table_version* t, table_version* next, long j) {
+    long factor = 1l << (t->num_bits - next->num_bits);
+    state hold;
+    for (long i = j * factor; i < (j + 1) * factor; i++) {
+      bckt* b = &t->buckets[i].v;
+      while (true) {
+	auto [s, tag] = b->ll();
+	if (!b->sc(tag, s.frozen())) continue;
+	for_each_in_state(s, [&] (const Entry& entry) {
+	  hold = state(hold, entry, [&] (const Entry& e, link* l) {return new_link(e,l);});
+	});
+	break;
+      }
+    }
+    initialize(next->buckets[j]);
+    next->buckets[j].v.store_sequential(hold);
+    // no one else updates a frozen bucket, so these will succeed
+    for (long i = j * factor; i < (j + 1) * factor; i++) {
+      bckt* b = &t->buckets[i].v;
+      auto [s, tag] = b->ll();
+      b->sc(tag, state(true));
+      retire_list(s.overflow_list());
+    }
+  }
+
+  // Tries to copy the block_size buckets of block block_num of t to
+  // its next version.  Returns false if the block was not Empty,
+  // i.e. it is being, or has been, copied by another thread.
+  bool try_copy_block(table_version* t, table_version* next, long block_num) {
+    status old = Empty;
+    // This is effectively a try lock on the block_num.
+    // It blocks other updates on the buckets associated with the block.
+    if (t->block_status[block_num] != Empty ||
+	!t->block_status[block_num].compare_exchange_strong(old, Working))
+      return false;
+    long start = block_num * t->block_size;
+
+    // copy block_size buckets
+    if (next->num_bits > t->num_bits) {
+      for (long i = start; i < start + t->block_size; i++)
+	copy_bucket(t, next, i);
+    } else {
+      long factor = 1l << (t->num_bits - next->num_bits);
+      for (long i = start; i < start + t->block_size; i += factor)
+	merge_buckets(t, next, i / factor);
+    }
+    t->block_status[block_num] = Done;
+    backoff::wake(t->block_status[block_num]);
+
+    // If all blocks have been copied then can set current table
+    // to next.
+    if (t->finished_blocks.finish(block_num)) {
+      current_table_version = next;
+      // t can be freed once no operation that started before it was
+      // replaced can still be running
+      t->retire_epoch = epoch::internal::get_epoch().get_current();
+    }
+    return true;
+  }
+
+  // Bounds the attempts of an update made by a Try operation.  An
+  // attempt fails if the bucket is being written when it is loaded, if
+  // another update changes it before the store-conditional, or if a
+  // resize is copying its bucket (rather than wait for the copy).
+  // At least one attempt is made, even if max_tries is less than 1.
+  struct try_budget {
+    long max_tries;
+    long tries = 0;
+    bool gave_up = false;
+    // counts an attempt, and returns true if there are none left
+    bool exhausted() {
+      if (tries++ < std::max(1l, max_tries)) return false;
+      return gave_up = true;
+    }
+  };
+
+  // Copies up to budget of the Empty blocks among the help_scan_limit
+  // blocks following block_num.  Returns the number copied.
+  long help_copy(table_version* t, table_version* next, long block_num, long budget) {
+    long num_blocks = t->size/t->block_size;
+    long copied = 0;
+    for (long j = 1; j <= help_scan_limit && copied < budget; j++)
+      copied += try_copy_block(t, next, (block_num + j) & (num_blocks - 1));
+    return copied;
+  }
+
   // If copying is ongoing (i.e., next is not null), and if the the
   // hash bucket given by hashid is not already copied, tries to copy
-  // the block_size buckets that containing hashid to the next larger
-  // table version.
-  void copy_if_needed(table_version* t, long hashid) {
+  // the block_size buckets that containing hashid to the next
+  // table version.  Then helps copy other blocks so that in total at
+  // most budget blocks are copied.  An update passes the index of its
+  // bucket, so its own block is copied first.  With a try budget,
+  // returns false rather than wait for another thread to finish
+  // copying the block, and otherwise returns true.
+  bool copy_if_needed(table_version* t, long hashid, long budget = migration_budget,
+		      try_budget* tries = nullptr) {
     table_version* next = t->next.load();
     if (next != nullptr) {
       long num_blocks = t->size/t->block_size;
-      long block_num = hashid & (num_blocks -1);
-      long start = block_num * t->block_size;
-      status st = t->block_status[block_num];
-      status old = Empty;
-      if (st == Done) return;
-
-      // if data is uninitialized, need to initialize
-      // if (st == Uninit || st == Initializing) {
-      // 	status x = Uninit;
-      // 	if (t->block_status[block_num].compare_exchange_strong(x, Working)) {
-      // 	  for (int i = start; i < start + t->block_size; i++) 
-      // 	    initialize(t->buckets[i]);
-      // 	  t->block_status[block_num] = Empty;
-      // 	} else {
-      // 	  while (t->block_status[block_num] == Initializing)
-      // 	    for (volatile int i=0; i < 100; i++);
-      // 	}
-      // }
-	
-      // This is effectively a try lock on the block_num.
-      // It blocks other updates on the buckets associated with the block.
-      else if (st == Empty &&
-	       t->block_status[block_num].compare_exchange_strong(old, Working)) {
-
-	// initialize block_status for next grow round
-	for (int i = 0; i < grow_factor; i++)
-	  next->block_status[grow_factor*block_num + i] = Empty;
-	
-	// copy block_size buckets
-	for (int i = start; i < start + t->block_size; i++) {
-	  copy_bucket(t, next, i);
-	}
-	t->block_status[block_num] = Done;
-	
-	// If all blocks have been copied then can set current table
-	// to next.  Note: this atomic fetch-and-add can be a
-	// bottleneck and is the reason the block sizes are reasonably
-	// large (e.g. 256).  A smarter combining tree could be used
-	// if smaller block sizes are needed.
-	if (++next->finished_block_count == num_blocks) {
-	  //std::cout << "expand done" << std::endl;
-	  current_table_version = next;
-	}
-      } else {
-	// If another thread is working on the block, wait until Done
-	while (t->block_status[block_num] == Working) {
-	  for (volatile int i=0; i < 100; i++);
+      long block_num = (hashid / t->block_size) & (num_blocks - 1);
+      if (t->block_status[block_num] != Done) {
+	if (try_copy_block(t, next, block_num)) budget--;
+	else {
+	  // If another thread is working on the block, help with
+	  // other blocks until it is Done, and only wait if there are
+	  // none nearby.
+	  backoff bk(100);
+	  while (t->block_status[block_num] == Working)
+	    if (help_copy(t, next, block_num, 1) == 0) {
+	      if (tries != nullptr) return false;
+	      bk.pause_on(t->block_status[block_num], Working);
+	    }
 	}
       }
+      if (budget > 0) help_copy(t, next, block_num, budget);
     }
+    return true;
   }
-    
+
+  // Copies all remaining blocks of t to its next version, if any, in
+  // parallel.  Must be run within an epoch, which also protects the
+  // tasks run by other workers.
+  void finish_copy(table_version* t) {
+    if (t->next.load() == nullptr) return;
+    parallel_for(t->size/t->block_size, [&] (long i) {
+      copy_if_needed(t, i * t->block_size, 0);});
+  }
+
+  // Repeatedly finishes any ongoing copy of the current version ht
+  // and, if next_bits(ht) is not negative, copies it to a new version
+  // with 2^next_bits(ht) buckets.  Then tries to free the old versions.
+  template <typename NextBits>
+  void resize(const NextBits& next_bits) {
+    while (epoch::with_epoch([&] {
+      table_version* ht = current_table_version.load();
+      if (ht->next.load() == nullptr) {
+	long bits = next_bits(ht);
+	if (bits < 0) return false;
+	new_version(ht, bits);
+      }
+      finish_copy(ht);
+      return true;}));
+    free_old_versions();
+  }
+
+  // Frees the table versions that have been replaced and that no
+  // operation can still be accessing, i.e. all operations that were
+  // running when it was replaced have finished.  This is the case
+  // once the epoch has advanced twice since.  All operations on the
+  // table must then load the current version within an epoch, so
+  // this does nothing unless the policy sets reclaim_versions.
+  // Should not be called from within an epoch since it tries to
+  // advance it.
+  void free_old_versions() {
+    if constexpr (!Policy::reclaim_versions) return;
+    if (initial_table_version.load() == current_table_version.load()) return;
+    // if fail to take, someone else is freeing them, so skip
+    bool expected = false;
+    if (freeing_versions.load() || !freeing_versions.compare_exchange_strong(expected, true))
+      return;
+    // try to advance the epoch enough for the oldest to be freed
+    auto& e = epoch::internal::get_epoch();
+    for (int i = 0; i < 2; i++) e.update_epoch();
+    table_version* t = initial_table_version.load();
+    while (t != current_table_version.load()) {
+      long r = t->retire_epoch.load();
+      if (r < 0 || e.get_current() < r + 2) break;
+      table_version* next = t->next.load();
+      initial_table_version = next;
+      delete t;
+      t = next;
+    }
+    freeing_versions = false;
+  }
+
+  // number of buckets sampled to estimate the load when deciding
+  // whether to shrink or grow
+  static constexpr long load_sample_size = 64;
+
+  // One in sample_rate updates of each thread does maintenance:
+  // freeing old versions, for removes checking if the table should
+  // shrink, and for inserts checking if it should grow (if the policy
+  // has a max_load_factor).  Counting per thread, rather than picking
+  // by the hash of the key, samples a workload that updates a few hot
+  // keys as well as one that updates many.
+  static constexpr int sample_rate = 256;
+  static bool sampled() {
+    static thread_local int countdown = sample_rate;
+    if (--countdown > 0) return false;
+    countdown = sample_rate;
+    return true;
+  }
+
+  // Estimates the load of the current version from a range of
+  // buckets near hashid (including their overflow lists), and if
+  // after shrinking by grow_factor it would be no more than that of a
+  // table constructed for the same number of entries
+  // (2^log_bucket_size / space_factor per bucket), starts shrinking.
+  // Must be run within an epoch, which also protects the lists.
+  void shrink_if_sparse(long hashid) {
+    table_version* ht = current_table_version.load();
+    if (ht->next.load() != nullptr || ht->num_bits - log_grow_factor < min_num_bits) return;
+    long n = std::min<long>(load_sample_size, ht->size);
+    long start = (hashid & (ht->size - 1)) & ~(n - 1);
+    long cnt = 0;
+    for (long i = start; i < start + n; i++)
+      cnt += ht->buckets[i].v.load().size();
+    if (cnt * grow_factor * Policy::space_factor <= (n << log_bucket_size))
+      shrink_table(ht, min_num_bits);
+  }
+
+  // Estimates the load of the current version from a range of
+  // buckets near hashid, and if it exceeds the policy's
+  // max_load_factor, starts growing.  Must be run within an epoch.
+  void grow_if_dense(long hashid) {
+    table_version* ht = current_table_version.load();
+    if (ht->next.load() != nullptr) return;
+    long n = std::min<long>(load_sample_size, ht->size);
+    long start = (hashid & (ht->size - 1)) & ~(n - 1);
+    long cnt = 0;
+    for (long i = start; i < start + n; i++)
+      cnt += ht->buckets[i].v.load().size();
+    if (cnt > Policy::max_load_factor * (n << log_bucket_size))
+      expand_table(ht);
+  }
+
+  // *********************************************
+  // Background migration
+  // *********************************************
+
+  // If background migration is enabled, a helper thread copies all
+  // blocks of a version to its next version as soon as the next
+  // version is created, rather than leaving the copying to the
+  // updates that land on uncopied blocks (finds never help).  This
+  // bounds the time a resize takes under any mix of operations.
+  struct migrator_state {
+    std::thread thread;
+    std::mutex mtx; // protects pending and stop
+    std::condition_variable cv;
+    bool pending = false; // a new version has been created
+    bool stop = false;
+    std::mutex working; // held while migrating, so clear can wait for it
+  };
+
+  // null if there is no background migration
+  migrator_state* migrator;
+
+  // Wakes up the helper thread.
+  void start_migration() {
+    {
+      std::lock_guard<std::mutex> lck(migrator->mtx);
+      migrator->pending = true;
+    }
+    migrator->cv.notify_one();
+  }
+
+  // Copies blocks of the current version until it has no next
+  // version.  Each block is copied in its own epoch so the helper
+  // does not hold up the epoch.  Then frees the old versions (if the
+  // policy reclaims them), which needs the epoch to advance.
+  void migrate_all() {
+    long i = 0;
+    while (epoch::with_epoch([&] {
+      table_version* ht = current_table_version.load();
+      if (ht->next.load() == nullptr) return false;
+      copy_if_needed(ht, (i++) * ht->block_size, 0);
+      return true;}));
+    if constexpr (!Policy::reclaim_versions) return;
+    for (int j = 0; j < 100; j++) {
+      free_old_versions();
+      if (initial_table_version.load() == current_table_version.load()) break;
+      std::this_thread::yield();
+    }
+  }
+
+  // The helper thread: waits for a new version, and migrates to it.
+  void migrate_loop() {
+    std::unique_lock<std::mutex> lck(migrator->mtx);
+    while (true) {
+      migrator->cv.wait(lck, [&] {return migrator->pending || migrator->stop;});
+      if (migrator->stop) return;
+      migrator->pending = false;
+      lck.unlock();
+      {
+	std::lock_guard<std::mutex> w(migrator->working);
+	migrate_all();
+      }
+      lck.lock();
+    }
+  }
+
+  void stop_migrator() {
+    if (migrator == nullptr) return;
+    {
+      std::lock_guard<std::mutex> lck(migrator->mtx);
+      migrator->stop = true;
+    }
+    migrator->cv.notify_one();
+    migrator->thread.join();
+    delete migrator;
+    migrator = nullptr;
+  }
+
   // *********************************************
   // Construction and Destruction
   // *********************************************
 
-  // Clear bucket, assuming it is not forwarded.
-  void clear_bucket(bckt* b) {
+  // True if the hash of the key of e is in the range of bucket idx of
+  // a version with 2^bits buckets.
+  static bool in_range(const Entry& e, long bits, long idx) {
+    return ((Entry::hash(e.get_key()) >> (48 - bits)) & ((1ul << bits) - 1)) == (size_t) idx;
+  }
+
+  // Calls g(b, s, keep) on each bucket b (with state s) that holds
+  // entries whose hash is in the range of bucket idx of a version with
+  // 2^bits buckets, starting at version t (which has at most 2^bits
+  // buckets), and following forwarded buckets to later versions.
+  // When growing a bucket is forwarded to grow_factor buckets, and
+  // when shrinking grow_factor buckets are forwarded to one, which
+  // then also holds entries outside the range.  keep(e) is true for
+  // the entries of s that are in the range.  Used by traversals so
+  // each entry is visited once.
+  template <typename G>
+  void visit_range(table_version* t, long bits, long idx, const G& g) {
+    bckt* b = &(t->buckets[idx >> (bits - t->num_bits)].v);
+    state s = b->load();
+    if (!s.is_forwarded()) {
+      if (bits == t->num_bits) g(b, s, [] (const Entry&) {return true;});
+      else g(b, s, [&] (const Entry& e) {return in_range(e, bits, idx);});
+    } else {
+      table_version* next = t->next.load();
+      long nb = next->num_bits;
+      if (nb <= bits) visit_range(next, bits, idx, g);
+      else for (long j = idx << (nb - bits); j < ((idx + 1) << (nb - bits)); j++)
+	     visit_range(next, nb, j, g);
+    }
+  }
+
+  // Clear bucket.  Returns false if it is frozen or forwarded (i.e.,
+  // being copied), in which case it needs to be revisited.
+  bool clear_bucket(bckt* b) {
     auto [s, tag] = b->ll();
-    if (!s.is_forwarded() && b->sc(tag, state())) {
+    if (s.is_forwarded() || s.is_frozen()) return false;
+    if (b->sc(tag, state())) {
       for (int j=0; j < std::min(s.buffer_cnt(), buffer_size); j++) {
 	entries_->retire_entry(s.buffer[j]);
       }
       retire_list_all(s.overflow_list());
     }
+    return true;
   }
 
   // Clears bucket or if the bucket is forwarded (during copying)
-  // then clear the forwarded buckets.
+  // then clear the buckets it is forwarded to.
   void clear_bucket_rec(table_version* t, long i) {
-    bckt* b = &(t->buckets[i].v);
-    state head = b->load();
-    if (!head.is_forwarded())
-      clear_bucket(b);
-    else {
-      table_version* next = t->next.load();
-      for (int j = 0; j < grow_factor; j++)
-	clear_bucket_rec(next, grow_factor * i + j);
+    bool done = false;
+    while (!done) {
+      done = true;
+      visit_range(t, t->num_bits, i, [&] (bckt* b, const state&, const auto&) {
+	done &= clear_bucket(b);});
     }
   }
 
   void clear_buckets() {
-    table_version* ht = current_table_version.load();
-    // clear buckets from current and future versions
-    parallel_for(ht->size, [&] (size_t i) {
-	clear_bucket_rec(ht, i);});
+    epoch::with_epoch([&] {
+      table_version* ht = current_table_version.load();
+      // clear buckets from current and future versions
+      parallel_for(ht->size, [&] (size_t i) {
+	clear_bucket_rec(ht, i);});});
+    reset_size_counts();
   }
   
   // Clear all memory.
   // Reinitialize to table of size 1 if specified, and by default.
   void clear(bool reinitialize = true) {
+    std::unique_lock<std::mutex> w;
+    if (migrator != nullptr) w = std::unique_lock<std::mutex>(migrator->working);
     clear_buckets();
 
     // now reclaim the arrays
@@ -560,16 +1141,68 @@ struct parlay_hash {
     // reinitialize
     if (reinitialize) {
       current_table_version = new table_version(1);
-      initial_table_version = current_table_version;
+      initial_table_version = current_table_version.load();
     }
   }
 
   Entries* entries_;
-  
+
+  // *********************************************
+  // Size counters
+  // *********************************************
+
+  // a per-thread count, padded so threads do not share cache lines
+  struct alignas(64) size_count {
+    std::atomic<long> n;
+    size_count() : n(0) {}
+  };
+
+  // only used if Policy::count_size
+  std::conditional_t<Policy::count_size, parlay::ThreadSpecific<size_count>, bool> size_counts;
+
+  // Adds d to the calling thread's count.  Only the owning thread
+  // writes a count, so no atomic read-modify-write is needed.
+  void add_to_size(long d) {
+    if constexpr (Policy::count_size) {
+      std::atomic<long>& c = size_counts->n;
+      c.store(c.load(std::memory_order_relaxed) + d, std::memory_order_relaxed);
+    }
+  }
+
+  void reset_size_counts() {
+    if constexpr (Policy::count_size)
+      size_counts.for_each([] (size_count& c) {c.n = 0;});
+  }
+
+  // Sum of the per-thread counts if Policy::count_size, otherwise
+  // the exact size.  Concurrent updates might or might not be
+  // included, and it is only exact if there are none.
+  long size_estimate() {
+    if constexpr (Policy::count_size) {
+      long sum = 0;
+      size_counts.for_each([&] (size_count& c) {sum += c.n.load(std::memory_order_relaxed);});
+      return std::max<long>(sum, 0);
+    } else return size();
+  }
+
+  // Uses the per-thread counts if Policy::count_size, and otherwise
+  // stops at the first non-empty bucket, which is fast unless the
+  // table is (nearly) empty.
+  bool empty() {
+    if constexpr (Policy::count_size) return size_estimate() == 0;
+    else return epoch::with_epoch([&] {
+      table_version* ht = current_table_version.load();
+      for (size_t i = 0; i < ht->size; i++)
+	if (bucket_size_rec(ht, i) > 0) return false;
+      return true;});
+  }
+
   // Creates initial table version for the given size.  The
   // clear_at_end allows to free up the epoch-based collector's
-  // memory, and the scheduler.
-  parlay_hash(long n, Entries* entries, bool clear_at_end = default_clear_at_end)
+  // memory, and the scheduler.  If background_migration is set, a
+  // helper thread does the copying when the table is resized.
+  parlay_hash(long n, Entries* entries, bool clear_at_end = default_clear_at_end,
+	      bool background_migration = false)
     : entries_(entries),
       clear_memory_and_scheduler_at_end(clear_at_end),
       sched_ref(clear_at_end ?
@@ -579,10 +1212,18 @@ struct parlay_hash {
 		new epoch::memory_pool<link>() :
 		&epoch::get_default_pool<link>()),
       current_table_version(new table_version(n)),
-      initial_table_version(current_table_version.load())
-  { }
+      initial_table_version(current_table_version.load()),
+      min_num_bits(current_table_version.load()->num_bits),
+      migrator(nullptr)
+  {
+    if (background_migration) {
+      migrator = new migrator_state;
+      migrator->thread = std::thread([this] {migrate_loop();});
+    }
+  }
 
   ~parlay_hash() {
+    stop_migrator();
     clear(false);
     if (clear_memory_and_scheduler_at_end) {
       delete sched_ref;
@@ -590,30 +1231,139 @@ struct parlay_hash {
     }
   }
 
+  // Replaces the contents of the table with n entries, where
+  // get_key(i) is the key of the i-th entry and constr(i) constructs
+  // it.  If a key appears more than once, the first is kept.  The
+  // table is sized for n entries and the entries are sorted by bucket
+  // so each bucket's state is built directly and stored with a
+  // sequential store, i.e., with no ll/sc, epoch announcements or
+  // retries.  Runs in parallel, but must not run concurrently with
+  // any other operation on the table.
+  template <typename GetKey, typename Constr>
+  void build(long n, const GetKey& get_key, const Constr& constr) {
+    clear(false);
+    table_version* ht = new table_version(n);
+    std::vector<std::optional<typename Entry::K>> held(keys_by_ref<GetKey> ? 0 : n);
+    std::vector<K> keys(n);
+    std::vector<std::pair<long,long>> order(n);
+    parallel_for(n, [&] (long i) {
+      keys[i] = batch_key(get_key, i, held, i);
+      order[i] = std::pair(ht->get_index(keys[i]), i);});
+    parallel_sort(order, std::less<std::pair<long,long>>());
+
+    // each block of buckets is filled by one task
+    long block_size = ht->block_size;
+    std::atomic<long> total = 0;
+    parallel_for(ht->size/block_size, [&] (long block_num) {
+      auto start = std::lower_bound(order.begin(), order.end(),
+				    std::pair(block_num * block_size, 0l));
+      long j = start - order.begin();
+      long cnt = 0;
+      while (j < n && order[j].first < (block_num + 1) * block_size) {
+	long idx = order[j].first;
+	state s;
+	for (; j < n && order[j].first == idx; j++) {
+	  long i = order[j].second;
+	  bool duplicate = false;
+	  for_each_in_state(s, [&] (const Entry& e) {duplicate |= e.equal(keys[i]);});
+	  if (!duplicate) {
+	    s = state(s, constr(i), [&] (const Entry& e, link* l) {return new_link(e,l);});
+	    cnt++;
+	  }
+	}
+	ht->buckets[idx].v.store_sequential(s);
+      }
+      if constexpr (Policy::count_size) total += cnt;
+    });
+    current_table_version = ht;
+    initial_table_version = ht;
+    min_num_bits = ht->num_bits;
+    add_to_size(total);
+  }
+
+  // Shrinks the table, by factors of grow_factor, to no smaller than
+  // the size it would have if constructed for its current number of
+  // entries, finishing any ongoing copy first.  The copying is done
+  // in parallel, with help from concurrent updates.  Also tries to
+  // free the old versions if the policy reclaims them, which
+  // otherwise will be done by later updates.
+  void shrink_to_fit() {
+    long bits = table_version::num_bits_for(size());
+    resize([&] (table_version* ht) {
+      return (ht->num_bits - log_grow_factor < bits) ? -1 : ht->num_bits - log_grow_factor;});
+  }
+
+  // Grows the table, if smaller, to the size it would have if
+  // constructed for n entries.  Unlike growing on overflow, which goes
+  // up by grow_factor at a time, this copies the entries once, directly
+  // to the new size, in parallel.  Can run concurrently with other
+  // operations, which help with the copying.
+  void reserve(long n) {
+    long bits = table_version::num_bits_for(n);
+    resize([&] (table_version* ht) {
+      return (ht->num_bits >= bits) ? -1 : bits;});
+  }
+
   // *********************************************
   // Operations
   // *********************************************
 
+  // ll of a bucket for an update.  With a budget, returns nullopt
+  // rather than wait for a write in progress.
+  static std::optional<std::pair<state, tag_type>> ll_for_update(bckt* b, try_budget* budget) {
+    if (budget == nullptr) return b->ll();
+    return b->try_ll();
+  }
+
+  // Pause between the attempts of a Try operation.  It has few
+  // attempts, so a short fixed spin spaces them out without the
+  // backoff growing to the point of yielding.
+  static constexpr int try_pause_spins = 50;
+  static void try_pause() {
+    for (volatile int i=0; i < try_pause_spins; i++);
+  }
+
+  // Pause after a failed attempt of an update, with the backoff for
+  // an unbounded update and a fixed one for a Try.
+  static void retry_pause(backoff& bk, try_budget* budget) {
+    if (budget == nullptr) bk.pause();
+    else try_pause();
+  }
+
   // Updates b, s, tag, and idx to the correct bucket, state, tag and
-  // index if the the state s is forwarded.  Is called recursively,
-  // but unlikely to go more than one level, and when not growing will
-  // return immediately.
-  void check_bucket_and_state(table_version* t, const K& k,
-			      big_atomic<state>*& b, state& s, tag_type& tag, long& idx) {
+  // index if the the state s is forwarded.  If frozen, first waits
+  // until it is forwarded.  Is called recursively, but unlikely to go
+  // more than one level, and when not resizing will return
+  // immediately.  With a try budget, returns false rather than wait
+  // for a frozen bucket or one being written, and otherwise returns
+  // true.
+  template <typename Q>
+  bool check_bucket_and_state(table_version* t, const Q& k,
+			      bckt*& b, state& s, tag_type& tag, long& idx,
+			      try_budget* budget = nullptr) {
+    backoff bk(100);
+    while (s.is_frozen()) {
+      if (budget != nullptr) return false;
+      bk.pause();
+      std::tie(s, tag) = b->ll();
+    }
     if (s.is_forwarded()) {
       table_version* nxt = t->next.load();
       idx = nxt->get_index(k);
       b = &(nxt->buckets[idx].v);
-      std::tie(s, tag) = b->ll();
-      check_bucket_and_state(nxt, k, b, s, tag, idx);
+      auto st = ll_for_update(b, budget);
+      if (!st.has_value()) return false;
+      std::tie(s, tag) = *st;
+      return check_bucket_and_state(nxt, k, b, s, tag, idx, budget);
     }
+    return true;
   }
 
   // find in the bucket, or if forwarded (during copying) then follow
   // through to the next table, possibly reapeatedly, although
   // unlikely.
-  template <typename F>
-  auto find_in_bucket_rec(table_version* t, bckt* s, const K& k, const F& f)
+  template <typename Q, typename F>
+  auto find_in_bucket_rec(table_version* t, bckt* s, const Q& k, const F& f)
     -> std::optional<typename std::invoke_result<F,Entry>::type>
   {
     state x = s->load();
@@ -629,37 +1379,130 @@ struct parlay_hash {
   // Returns an optional which is empty if the key is not in the table,
   // and contains f(e) otherwise, where e is the entry matching the key
   // NOTE: this is the most important function to opmitize for performance
-  // Hence one hand inline and one prefetch (not used anywhere else in code).
-  template <typename F>
-  auto Find(const K& k, const F& f)
+  // Hence one hand inline and one prefetch.
+  // The key can be a lookup key other than K (see hashed_key) as
+  // long as Entry::hash and Entry::equal accept it.
+  template <typename Q, typename F>
+  auto Find(const Q& k, const F& f)
     -> std::optional<typename std::invoke_result<F,Entry>::type>
   {
+    using rtype = std::optional<typename std::invoke_result<F,Entry>::type>;
+    // if versions are freed, the current one can only be loaded in an epoch
+    if constexpr (Policy::reclaim_versions)
+      return epoch::with_epoch([&] () -> rtype {
+	table_version* ht = current_table_version.load();
+	return find_in_bucket_rec(ht, ht->get_bucket(k), k, f);});
     table_version* ht = current_table_version.load();
-    long idx = ht->get_index(k);
-    bckt* b = &(ht->buckets[idx].v);
-    // if entries are direct, then safe to scan the buffer without epoch protection
-    if constexpr (Entry::Direct) {
-      auto [s, tag] = b->ll();
-      if (s.is_forwarded()) 
-	check_bucket_and_state(ht, k, b, s, tag, idx);
-      for (long i = 0; i < std::min(s.buffer_cnt(), buffer_size); i++)
-	if (s.buffer[i].equal(k))
-	  return std::optional(f(s.buffer[i]));
+    bckt* b = ht->get_bucket(k);
+    // if entries are direct and nothing is freed, then safe to scan
+    // the buffer without epoch protection
+    if constexpr (epoch_free_reads) {
+      state s = b->load();
+      while (s.is_forwarded()) {
+	ht = ht->next.load();
+	b = ht->get_bucket(k);
+	s = b->load();
+      }
+      int i = find_in_buffer(s, k);
+      if (i >= 0) return rtype(f(s.buffer[i]));
       // if not found and not overfull, then done
       if (s.buffer_cnt() <= buffer_size) return std::nullopt;
       // otherwise need to search overflow, which requires protection
-      return epoch::with_epoch([&, tag=tag, &s = s] {
-        // if state has not changed, then just search list
-	if (b->lv(tag)) return find_in_list(s.overflow_list(), k, f).first;
-	return find_in_bucket_rec(ht, b, k, f);
-      });
-    } else { // if using indirection always use protection
+      return epoch::with_epoch([&] () -> rtype {
+	return find_in_bucket_rec(ht, b, k, f);});
+    } else {
       __builtin_prefetch(b); // allows read to be pipelined with epoch announcement
-      return epoch::with_epoch([&] () -> std::optional<typename std::invoke_result<F,Entry>::type> {
-	  return find_in_bucket_rec(ht, b, k, f);});
-
+      return epoch::with_epoch([&] () -> rtype {
+	return find_in_bucket_rec(ht, b, k, f);});
+    }
+  }
 
+  // As find_in_bucket_rec, but returns nullopt if a bucket it reads is
+  // being written.
+  template <typename Q, typename F>
+  auto try_find_in_bucket_rec(table_version* t, bckt* b, const Q& k, const F& f)
+    -> std::optional<std::optional<typename std::invoke_result<F,Entry>::type>>
+  {
+    using rtype = std::optional<typename std::invoke_result<F,Entry>::type>;
+    auto st = b->try_ll();
+    if (!st.has_value()) return std::nullopt;
+    const state& x = st->first;
+    if (x.is_forwarded()) {
+      table_version* nxt = t->next.load();
+      return try_find_in_bucket_rec(nxt, nxt->get_bucket(k), k, f);
     }
+    return std::optional<rtype>(find_in_state(x, k, f));
+  }
+
+  // Like Find, but makes at most max_tries attempts (at least one),
+  // each of which fails if the bucket is being written.
+  template <typename Q, typename F>
+  auto TryFind(const Q& k, const F& f, long max_tries)
+    -> try_result<std::optional<typename std::invoke_result<F,Entry>::type>>
+  {
+    using rtype = std::optional<typename std::invoke_result<F,Entry>::type>;
+    max_tries = std::max(1l, max_tries);
+    return epoch::with_epoch([&] () -> try_result<rtype> {
+      for (long i = 0; i < max_tries; i++) {
+	table_version* ht = current_table_version.load();
+	if (auto r = try_find_in_bucket_rec(ht, ht->get_bucket(k), k, f))
+	  return {true, std::move(*r)};
+	if (i + 1 < max_tries) try_pause();
+      }
+      return {false, rtype()};});
+  }
+
+  // Batch operations get their keys from get_key(i).  A prehashed key
+  // can point at the key it was made from, so unless get_key returns
+  // a reference to a key of the entries' key type (which must then
+  // stay valid during the batch), batch_key first copies the key into
+  // slot j of held, which the batch keeps until it is done with it.
+  template <typename GetKey>
+  static constexpr bool keys_by_ref =
+    std::is_lvalue_reference_v<std::invoke_result_t<const GetKey&, long>> &&
+    std::is_same_v<std::remove_cv_t<std::remove_reference_t<
+		     std::invoke_result_t<const GetKey&, long>>>, typename Entry::K>;
+
+  template <typename GetKey, typename Held>
+  static K batch_key(const GetKey& get_key, long i, Held& held, long j) {
+    if constexpr (keys_by_ref<GetKey>) return Entry::make_key(get_key(i));
+    else return Entry::make_key(held[j].emplace(get_key(i)));
+  }
+
+  // number of buckets that FindBatch prefetches ahead of the one it
+  // is scanning.  Should be enough to cover memory latency, but not
+  // much more than the number of outstanding misses a core supports.
+  static constexpr long prefetch_distance = 16;
+
+  // Finds a batch of n keys, where get_key(i) returns the i-th key
+  // (of the entries' key type, or convertible to it).  Calls report(i,
+  // r) for each i, where r is what Find would return for that key and
+  // f.  Buckets are hashed and prefetched prefetch_distance keys ahead
+  // of the one being scanned, so the cache misses for different keys
+  // overlap.  Uses a single epoch announcement for the whole batch.
+  template <typename GetKey, typename F, typename Report>
+  void FindBatch(long n, const GetKey& get_key, const F& f, const Report& report) {
+    constexpr long d = prefetch_distance;
+    // circular buffers of keys that have been prefetched, their
+    // buckets, and the keys they were made from (see batch_key)
+    std::array<std::optional<K>, d> keys;
+    std::array<bckt*, d> bs;
+    std::array<std::optional<typename Entry::K>, keys_by_ref<GetKey> ? 0 : d> held;
+    epoch::with_epoch([&] {
+      table_version* ht = current_table_version.load();
+      auto fetch = [&] (long i) {
+	long j = i % d;
+	keys[j].emplace(batch_key(get_key, i, held, j));
+	bs[j] = ht->get_bucket(*keys[j]);
+	prefetch_bucket(bs[j]);
+      };
+      for (long i = 0; i < std::min(n, d); i++) fetch(i);
+      for (long i = 0; i < n; i++) {
+	long j = i % d;
+	report(i, find_in_bucket_rec(ht, bs[j], *keys[j], f));
+	// refills slot j, so only after its key has been used
+	if (i + d < n) fetch(i + d);
+      }});
   }
 
   // Inserts at key, and does nothing if key already in the table.
@@ -668,96 +1511,199 @@ struct parlay_hash {
   // contains f(e) if not, where e is the entry matching the key.
   template <typename Constr, typename F>
   auto Insert(const K& key, const Constr& constr, const F& f)
+    -> std::optional<typename std::invoke_result<F,Entry>::type> {
+    return insert_with(key, constr, f, nullptr);
+  }
+
+  // Like Insert, but makes at most max_tries attempts (at least one).
+  template <typename Constr, typename F>
+  auto TryInsert(const K& key, const Constr& constr, const F& f, long max_tries)
+    -> try_result<std::optional<typename std::invoke_result<F,Entry>::type>> {
+    try_budget budget{max_tries};
+    auto r = insert_with(key, constr, f, &budget);
+    return {!budget.gave_up, std::move(r)};
+  }
+
+  template <typename Constr, typename F>
+  auto insert_with(const K& key, const Constr& constr, const F& f, try_budget* budget)
     -> std::optional<typename std::invoke_result<F,Entry>::type>
   {
     using rtype = std::optional<typename std::invoke_result<F,Entry>::type>;
-    return epoch::with_epoch([&] () -> rtype {
-			       auto [e, flag] = insert_(key, constr);
-			       if (flag) return {};
-			       return rtype(f(e));});
+    rtype r = epoch::with_epoch([&] () -> rtype {
+			       auto x = insert_(key, constr, budget);
+			       if (!x.has_value() || x->second) return {};
+			       return rtype(f(x->first));});
+    if (budget != nullptr && budget->gave_up) return r;
+    if (!r.has_value()) add_to_size(1);
+    if (sampled()) {
+      if constexpr (Policy::max_load_factor > 0)
+	if (!r.has_value())
+	  epoch::with_epoch([&] {
+	    table_version* ht = current_table_version.load();
+	    grow_if_dense(ht->get_index(key));});
+      free_old_versions();
+    }
+    return r;
   }
 
+  // Returns the entry with the key and whether it was inserted, or
+  // nullopt if the budget runs out.  The entry is constructed at most
+  // once, the first time an insert is attempted, and reused if the
+  // attempt fails.  It is retired if the key turns out to be present,
+  // or if the budget runs out.
   template <typename Constr>
-  auto insert_(const K& key, const Constr& constr) -> std::pair<Entry, bool> {
+  auto insert_(const K& key, const Constr& constr, try_budget* budget = nullptr)
+    -> std::optional<std::pair<Entry, bool>> {
     table_version* ht = current_table_version.load();
     long idx = ht->get_index(key);
     auto b = &(ht->buckets[idx].v);
-    int delay = 200;
+    std::optional<Entry> new_e;
+    auto found = [&] (const Entry& e) {
+      if (new_e.has_value()) entries_->retire_entry(*new_e);
+      return std::pair(e, false);
+    };
+    backoff bk;
+    int attempts = 0;
     while (true) {
-      auto [s, tag] = b->ll();
-      copy_if_needed(ht, idx);
-      check_bucket_and_state(ht, key, b, s, tag, idx);
+      if constexpr (combining)
+	if (budget == nullptr && attempts++ == Policy::combine_after) {
+	  if (!new_e.has_value()) new_e = constr();
+	  std::optional<Entry> r = combine(insert_op, key, &*new_e);
+	  if (r.has_value()) return found(*r);
+	  return std::pair(*new_e, true);
+	}
+      if (budget != nullptr && budget->exhausted()) {
+	if (new_e.has_value()) entries_->retire_entry(*new_e);
+	return std::nullopt;
+      }
+      if (!copy_if_needed(ht, idx, migration_budget, budget)) {
+	retry_pause(bk, budget);
+	continue;
+      }
+      auto st = ll_for_update(b, budget);
+      if (!st.has_value()) {
+	retry_pause(bk, budget);
+	continue;
+      }
+      auto [s, tag] = *st;
+      if (!check_bucket_and_state(ht, key, b, s, tag, idx, budget)) {
+	retry_pause(bk, budget);
+	continue;
+      }
       long len = s.buffer_cnt();
       // if found in buffer then done
-      for (long i = 0; i < std::min(len, buffer_size); i++)
-	if (s.buffer[i].equal(key)) return std::pair(s.buffer[i], false);
-      if (len < buffer_size) { // buffer has space, insert to end of buffer
-	Entry new_e = constr();
-	if (b->sc(tag, state(s, new_e))) return std::pair(new_e, true);
-	entries_->retire_entry(new_e); // if failed need to ty again
-      } else if (len == buffer_size) { // buffer full, insert new link
-	Entry new_e = constr();
-	link* new_head = new_link(new_e, nullptr);
-	if (b->sc(tag, state(s, new_head))) 
-	  return std::pair(new_e, true);
-	entries_->retire_entry(new_head->entry); // if failed need to try again
-	retire_link(new_head);
+      int i = find_in_buffer(s, key);
+      if (i >= 0) return found(s.buffer[i]);
+      if (len <= buffer_size) { // buffer has space, or insert new link
+	if (!new_e.has_value()) new_e = constr();
+	if (len < buffer_size) { // insert to end of buffer
+	  if (b->sc(tag, state(s, *new_e))) return std::pair(*new_e, true);
+	} else { // buffer full, insert new link
+	  link* new_head = new_link(*new_e, nullptr);
+	  if (b->sc(tag, state(s, new_head)))
+	    return std::pair(*new_e, true);
+	  retire_link(new_head); // if failed need to try again
+	}
       } else { // buffer overfull, need to check if in list
 	auto [x, list_len] = find_in_list(s.overflow_list(), key, identity);
 	if (list_len + buffer_size > ht->overflow_size) expand_table(ht);
-	if (x.has_value()) return std::pair(*x, false); // if in list, then done
-	Entry new_e = constr();
-	link* new_head = new_link(new_e, s.overflow_list());
+	if (x.has_value()) return found(*x); // if in list, then done
+	if (!new_e.has_value()) new_e = constr();
+	link* new_head = new_link(*new_e, s.overflow_list());
 	if (b->sc(tag, state(s, new_head))) // try to add to head of list
-	  return std::pair(new_e, true);
-	entries_->retire_entry(new_head->entry); // if failed need to ty again
-	retire_link(new_head);
+	  return std::pair(*new_e, true);
+	retire_link(new_head); // if failed need to try again
       }
-      // delay before trying again, only marginally helps
-      for (volatile int i=0; i < delay; i++);
-      delay = std::min(2*delay, 5000); // 1000-10000 are about equally good
+      retry_pause(bk, budget);
     }
   }
 
+  // If the key is in the table, replaces its entry e with
+  // constr(std::optional(e)) and returns g(e), otherwise inserts
+  // constr(std::nullopt) and returns nullopt.
   template <typename Constr, typename G>
   auto Upsert(const K& key, const Constr& constr, G& g)
+    -> std::optional<typename std::invoke_result<G,Entry>::type> {
+    return upsert_<true>(key, constr, g);
+  }
+
+  // Like Upsert, but makes at most max_tries attempts (at least one).
+  template <typename Constr, typename G>
+  auto TryUpsert(const K& key, const Constr& constr, G& g, long max_tries)
+    -> try_result<std::optional<typename std::invoke_result<G,Entry>::type>> {
+    try_budget budget{max_tries};
+    auto r = upsert_<true>(key, constr, g, &budget);
+    return {!budget.gave_up, std::move(r)};
+  }
+
+  // Like Upsert but with an entry that has already been constructed,
+  // and that is used whether or not the key is in the table.  The
+  // entry is never retired by this call, so it is only constructed once.
+  template <typename G>
+  auto Assign(const K& key, const Entry& e, G& g)
+    -> std::optional<typename std::invoke_result<G,Entry>::type> {
+    return upsert_<false>(key, [&] (const std::optional<Entry>&) {return e;}, g);
+  }
+
+  // If Fresh, constr creates a new entry on each call, which is
+  // retired if it is not installed.
+  template <bool Fresh, typename Constr, typename G>
+  auto upsert_(const K& key, const Constr& constr, G& g, try_budget* budget = nullptr)
     -> std::optional<typename std::invoke_result<G,Entry>::type>
   {
     using rtype = std::optional<typename std::invoke_result<G,Entry>::type>;
-    table_version* ht = current_table_version.load();
-    long idx = ht->get_index(key);
-    auto b = &(ht->buckets[idx].v);
-    return epoch::with_epoch([&] () -> rtype {
-      int delay = 200;
+    rtype result = epoch::with_epoch([&] () -> rtype {
+      table_version* ht = current_table_version.load();
+      long idx = ht->get_index(key);
+      auto b = &(ht->buckets[idx].v);
+      backoff bk;
+      int attempts = 0;
       while (true) {
-	auto [s, tag] = b->ll();
+	if constexpr (combining)
+	  if (budget == nullptr && attempts++ == Policy::combine_after) {
+	    std::optional<Entry> r = combine(upsert_op, key, nullptr, Fresh, &constr);
+	    if (r.has_value()) return rtype(g(*r));
+	    return std::nullopt;
+	  }
+	if (budget != nullptr && budget->exhausted()) return std::nullopt;
+	if (!copy_if_needed(ht, idx, migration_budget, budget)) {
+	  retry_pause(bk, budget);
+	  continue;
+	}
+	auto st = ll_for_update(b, budget);
+	if (!st.has_value()) {
+	  retry_pause(bk, budget);
+	  continue;
+	}
+	auto [s, tag] = *st;
+	if (!check_bucket_and_state(ht, key, b, s, tag, idx, budget)) {
+	  retry_pause(bk, budget);
+	  continue;
+	}
 	state out_s = s;
-	copy_if_needed(ht, idx);
-	check_bucket_and_state(ht, key, b, s, tag, idx);
 	long len = s.buffer_cnt();
-	bool cont = false;
-	for (long i = 0; i < std::min(len, buffer_size); i++) {
-	  if (s.buffer[i].equal(key)) {
-	    Entry new_e = constr(std::optional(s.buffer[i]));
-	    out_s.buffer[i] = new_e;
-	    if (b->sc(tag, out_s)) return g(s.buffer[i]);
-	    else {
-	      entries_->retire_entry(new_e);
-	      cont = true;
-	      break;
-	    }
+	int i = find_in_buffer(s, key);
+	if (i >= 0) {
+	  // the new entry has the same key, so the fingerprint is unchanged
+	  Entry new_e = constr(std::optional(s.buffer[i]));
+	  out_s.buffer[i] = new_e;
+	  if (b->sc(tag, out_s)) {
+	    rtype r = g(s.buffer[i]);
+	    entries_->retire_entry(s.buffer[i]); // retire the replaced entry
+	    return r;
 	  }
+	  if constexpr (Fresh) entries_->retire_entry(new_e);
+	  continue;
 	}
-	if (cont) continue;
 	if (len < buffer_size) { // buffer has space, insert to end of buffer
 	  Entry new_e = constr(std::optional<Entry>());
 	  if (b->sc(tag, state(s, new_e))) return std::nullopt;
-	  entries_->retire_entry(new_e); // if failed need to ty again
+	  if constexpr (Fresh) entries_->retire_entry(new_e); // if failed need to ty again
 	} else if (len == buffer_size) { // buffer just full, insert new link
 	  link* new_head = new_link(constr(std::optional<Entry>()), nullptr);
 	  if (b->sc(tag, state(s, new_head))) 
 	    return std::nullopt;
-	  entries_->retire_entry(new_head->entry); // if failed need to try again
+	  if constexpr (Fresh) entries_->retire_entry(new_head->entry); // if failed need to try again
 	  retire_link(new_head);
 	} else { // buffer overfull, need to check if in list
 	  link* old_head = s.overflow_list();
@@ -765,6 +1711,7 @@ struct parlay_hash {
 	  if (new_head != nullptr) {
 	    if (b->sc(tag, state(s, new_head))) {// try to add to head of list
 	      rtype r = std::optional(g(updated->entry));
+	      entries_->retire_entry(updated->entry);
 	      retire_list_n(old_head, list_len); // retire old list
 	      return r;
 	    } else retire_list_n(new_head, list_len);
@@ -773,50 +1720,95 @@ struct parlay_hash {
 	    new_head = new_link(constr(std::optional<Entry>()), old_head);
 	    if (b->sc(tag, state(s, new_head))) // try to add to head of list
 	      return std::nullopt;
-	    entries_->retire_entry(new_head->entry); // if failed need to ty again
+	    if constexpr (Fresh) entries_->retire_entry(new_head->entry); // if failed need to ty again
 	    retire_link(new_head);
 	  }	    
 	}
-	// delay before trying again, only marginally helps
-	for (volatile int i=0; i < delay; i++);
-	delay = std::min(2*delay, 5000); // 1000-10000 are about equally good
+	retry_pause(bk, budget);
       }
     });
+    if (!result.has_value() && !(budget != nullptr && budget->gave_up))
+      add_to_size(1); // was inserted
+    return result;
   }
 
   // Removes entry with given key
   // Returns an optional which is empty if the key is not in the table,
   // and contains f(e) otherwise, where e is the entry that is removed.
-  template <typename F>
-  auto Remove(const K& key, const F& f)
+  // As with Find, the key can be a lookup key.
+  template <typename Q, typename F>
+  auto Remove(const Q& key, const F& f)
+    -> std::optional<typename std::invoke_result<F,Entry>::type> {
+    return remove_(key, f, nullptr);
+  }
+
+  // Like Remove, but makes at most max_tries attempts (at least one).
+  template <typename Q, typename F>
+  auto TryRemove(const Q& key, const F& f, long max_tries)
+    -> try_result<std::optional<typename std::invoke_result<F,Entry>::type>> {
+    try_budget budget{max_tries};
+    auto r = remove_(key, f, &budget);
+    return {!budget.gave_up, std::move(r)};
+  }
+
+  // One attempt to remove the key from a bucket of direct entries
+  // without entering an epoch, as Find does.  Only succeeds if no
+  // resize is under way and the bucket is not overfull, and otherwise
+  // returns nullopt so the caller takes the protected path.
+  template <typename Q, typename F>
+  auto remove_without_epoch(const Q& key, const F& f)
+    -> std::optional<std::optional<typename std::invoke_result<F,Entry>::type>> {
+    using rtype = std::optional<typename std::invoke_result<F,Entry>::type>;
+    table_version* ht = current_table_version.load();
+    if (ht->next.load() != nullptr) return std::nullopt;
+    bckt* b = ht->get_bucket(key);
+    auto [s, tag] = b->ll();
+    if (s.is_forwarded() || s.is_frozen() || s.buffer_cnt() > buffer_size)
+      return std::nullopt;
+    int i = find_in_buffer(s, key);
+    if (i == -1) return std::optional(rtype());
+    if (!b->sc(tag, state(s, i))) return std::nullopt;
+    return std::optional(rtype(f(s.buffer[i])));
+  }
+
+  template <typename Q, typename F>
+  auto remove_(const Q& key, const F& f, try_budget* budget)
     -> std::optional<typename std::invoke_result<F,Entry>::type>
   {
     using rtype = std::optional<typename std::invoke_result<F,Entry>::type>;
-    table_version* ht = current_table_version.load();
-    long idx = ht->get_index(key);
-    auto b = &(ht->buckets[idx].v);
-    // if entries are direct safe to scan the buffer without epoch protection
-    if constexpr (Entry::Direct) {
-      auto [s, tag] = b->ll();
-      copy_if_needed(ht, idx);
-      check_bucket_and_state(ht, key, b, s, tag, idx);
-      if (s.buffer_cnt() <= buffer_size) {
-	int i = find_in_buffer(s, key);
-	if (i == -1) return std::nullopt;
-	if (b->sc(tag, state(s, i))) {
-	  rtype r = f(s.buffer[i]);
-	  entries_->retire_entry(s.buffer[i]);
-	  return r;
-	} // if sc failed, will need to try again
-      }
-    }
-    // if buffer overfull, or indirect, then need to protect
-    return epoch::with_epoch([&] () -> rtype {
-      int delay = 200;
+    std::optional<rtype> quick;
+    if constexpr (epoch_free_reads)
+      if (budget == nullptr) quick = remove_without_epoch(key, f);
+    // if not done, then need to protect
+    rtype result = quick.has_value() ? std::move(*quick) : epoch::with_epoch([&] () -> rtype {
+      table_version* ht = current_table_version.load();
+      long idx = ht->get_index(key);
+      auto b = &(ht->buckets[idx].v);
+      backoff bk;
+      int attempts = 0;
       while (true) {
-        auto [s, tag] = b->ll();
-	copy_if_needed(ht, idx);
-	check_bucket_and_state(ht, key, b, s, tag, idx);
+	// lookup keys are not combined, since a record holds a K
+	if constexpr (combining && std::is_same_v<Q, K>)
+	  if (budget == nullptr && attempts++ == Policy::combine_after) {
+	    std::optional<Entry> r = combine(remove_op, key);
+	    if (r.has_value()) return rtype(f(*r));
+	    return std::nullopt;
+	  }
+	if (budget != nullptr && budget->exhausted()) return std::nullopt;
+	if (!copy_if_needed(ht, idx, migration_budget, budget)) {
+	  retry_pause(bk, budget);
+	  continue;
+	}
+	auto st = ll_for_update(b, budget);
+	if (!st.has_value()) {
+	  retry_pause(bk, budget);
+	  continue;
+	}
+	auto [s, tag] = *st;
+	if (!check_bucket_and_state(ht, key, b, s, tag, idx, budget)) {
+	  retry_pause(bk, budget);
+	  continue;
+	}
 	int i = find_in_buffer(s, key);
 	if (i >= 0) { // found in buffer
 	  if (s.buffer_cnt() > buffer_size) { // need to backfill from list
@@ -849,44 +1841,339 @@ struct parlay_hash {
           } // if sc failed, will need to try again
           retire_list_n(new_list, cnt - 1); // failed, retire new list
 	}
-	for (volatile int i=0; i < delay; i++);
-	delay = std::min(2*delay, 5000); // 1000-10000 are about equally good
+	retry_pause(bk, budget);
       }
     });
+    if (result.has_value()) add_to_size(-1);
+    if (result.has_value() && sampled()) {
+      if constexpr (Policy::reclaim_versions)
+	epoch::with_epoch([&] {
+	  table_version* ht = current_table_version.load();
+	  shrink_if_sparse(ht->get_index(key));});
+      free_old_versions();
+    }
+    return result;
+  }
+
+  // *********************************************
+  // Batched updates
+  // *********************************************
+
+  // The kind of operation applied by update_batch
+  enum batch_op : char {insert_op, upsert_op, remove_op};
+
+  // Applies operations ops[0..m) of a batch, all of which go to bucket
+  // idx of version t, with a single ll/sc on the bucket.  The
+  // operations are applied in order to a copy of the bucket's entries,
+  // from which one new state is built.  If the bucket has been
+  // forwarded, the operations are regrouped by their bucket in the
+  // next version.  Must be run within an epoch.
+  template <batch_op Op, typename Constr, typename F, typename Report>
+  void apply_to_bucket(table_version* t, long idx, const long* ops, long m,
+		       const std::vector<K>& keys, const Constr& constr,
+		       const F& f, const Report& report) {
+    using rtype = std::optional<typename std::invoke_result<F,Entry>::type>;
+    bckt* b = &(t->buckets[idx].v);
+    std::vector<Entry> current, created, dropped;
+    std::vector<rtype> results(m);
+    backoff bk;
+    while (true) {
+      copy_if_needed(t, idx);
+      auto [s, tag] = b->ll();
+      if (s.is_frozen()) { // wait until forwarded
+	bk.pause();
+	continue;
+      }
+      if (s.is_forwarded()) {
+	table_version* nxt = t->next.load();
+	std::vector<std::pair<long,long>> sub(m);
+	for (long j = 0; j < m; j++) sub[j] = std::pair(nxt->get_index(keys[ops[j]]), ops[j]);
+	std::sort(sub.begin(), sub.end());
+	std::vector<long> sub_ops(m);
+	for (long j = 0; j < m; j++) sub_ops[j] = sub[j].second;
+	for (long start = 0, end = 0; start < m; start = end) {
+	  while (end < m && sub[end].first == sub[start].first) end++;
+	  apply_to_bucket<Op>(nxt, sub[start].first, sub_ops.data() + start, end - start,
+			      keys, constr, f, report);
+	}
+	return;
+      }
+      current.clear(); created.clear(); dropped.clear();
+      for_each_in_state(s, [&] (const Entry& e) {current.push_back(e);});
+      long old_size = current.size();
+      for (long j = 0; j < m; j++) {
+	long i = ops[j];
+	size_t pos = 0;
+	while (pos < current.size() && !current[pos].equal(keys[i])) pos++;
+	bool found = pos < current.size();
+	results[j] = found ? rtype(f(current[pos])) : rtype();
+	if constexpr (Op == insert_op) {
+	  if (!found) {
+	    created.push_back(constr(i));
+	    current.push_back(created.back());
+	  }
+	} else if constexpr (Op == upsert_op) {
+	  created.push_back(found ? constr(i, std::optional(current[pos]))
+			    : constr(i, std::optional<Entry>()));
+	  if (found) {
+	    dropped.push_back(current[pos]);
+	    current[pos] = created.back();
+	  } else current.push_back(created.back());
+	} else if (found) {
+	  dropped.push_back(current[pos]);
+	  current[pos] = current.back();
+	  current.pop_back();
+	}
+      }
+      // nothing changed (e.g. all inserts of keys already present), so
+      // the operations can linearize at the ll.
+      if (created.size() == 0 && dropped.size() == 0) break;
+      if ((long) current.size() > t->overflow_size) expand_table(t);
+      state new_s;
+      for (const Entry& e : current)
+	new_s = state(new_s, e, [&] (const Entry& e, link* l) {return new_link(e,l);});
+      if (b->sc(tag, new_s)) {
+	retire_list(s.overflow_list());
+	for (Entry& e : dropped) entries_->retire_entry(e);
+	add_to_size((long) current.size() - old_size);
+	break;
+      }
+      // failed, so retire everything new, and try again
+      retire_list(new_s.overflow_list());
+      for (Entry& e : created) entries_->retire_entry(e);
+      bk.pause();
+    }
+    for (long j = 0; j < m; j++) report(ops[j], std::move(results[j]));
+  }
+
+  // Applies a batch of n operations of the same kind, where
+  // get_key(i) is the key of the i-th.  The operations are sorted by
+  // bucket so all those on one bucket are applied together with a
+  // single store-conditional, and a single epoch announcement is
+  // used for the batch.  Operations on the same key are applied in
+  // order of their index.  Calls report(i, r) with the result r of
+  // the i-th operation, which is the same as for the non-batched
+  // version.  For insert_op constr(i) constructs the i-th entry, and
+  // for upsert_op constr(i, std::optional<Entry>) does.
+  template <batch_op Op, typename GetKey, typename Constr, typename F, typename Report>
+  void update_batch(long n, const GetKey& get_key, const Constr& constr,
+		    const F& f, const Report& report) {
+    std::vector<std::optional<typename Entry::K>> held(keys_by_ref<GetKey> ? 0 : n);
+    std::vector<K> keys(n);
+    for (long i = 0; i < n; i++) keys[i] = batch_key(get_key, i, held, i);
+    epoch::with_epoch([&] {
+      table_version* ht = current_table_version.load();
+      std::vector<std::pair<long,long>> order(n);
+      for (long i = 0; i < n; i++) order[i] = std::pair(ht->get_index(keys[i]), i);
+      std::sort(order.begin(), order.end());
+      std::vector<long> ops(n);
+      for (long i = 0; i < n; i++) ops[i] = order[i].second;
+      for (long start = 0, end = 0; start < n; start = end) {
+	while (end < n && order[end].first == order[start].first) end++;
+	apply_to_bucket<Op>(ht, order[start].first, ops.data() + start, end - start,
+			    keys, constr, f, report);
+      }
+      if constexpr (Policy::reclaim_versions)
+	if (Op == remove_op && n > 0) shrink_if_sparse(order[n/2].first);
+      if constexpr (Policy::max_load_factor > 0)
+	if (Op != remove_op && n > 0) grow_if_dense(order[n/2].first);
+    });
+    free_old_versions();
+  }
+
+  // Batched version of Insert.  constr(i) constructs the i-th entry.
+  template <typename GetKey, typename Constr, typename F, typename Report>
+  void InsertBatch(long n, const GetKey& get_key, const Constr& constr,
+		   const F& f, const Report& report) {
+    update_batch<insert_op>(n, get_key, constr, f, report);
+  }
+
+  // Batched version of Upsert.  constr(i, std::optional<Entry>)
+  // constructs the i-th entry given the old entry, if any.
+  template <typename GetKey, typename Constr, typename G, typename Report>
+  void UpsertBatch(long n, const GetKey& get_key, const Constr& constr,
+		   const G& g, const Report& report) {
+    update_batch<upsert_op>(n, get_key, constr, g, report);
+  }
+
+  // Batched version of Remove.
+  template <typename GetKey, typename F, typename Report>
+  void RemoveBatch(long n, const GetKey& get_key, const F& f, const Report& report) {
+    update_batch<remove_op>(n, get_key, [] (long) {return Entry();}, f, report);
+  }
+
+  // *********************************************
+  // Combining updates on contended buckets
+  // *********************************************
+
+  // An update that keeps failing on a bucket (see
+  // Policy::combine_after) publishes a record of itself on a slot and
+  // waits until it is marked done.  While waiting it tries to take the
+  // slot, and if it does it takes all records published on the slot
+  // and applies them, so the winner of a contended bucket applies the
+  // pending updates of the losers in one new state, as with
+  // update_batch.  Keys are mapped to slots by the high bits of their
+  // hash, so the keys of a bucket go to the same slot.  Records are
+  // on the stack of their owner, which waits for them to be done.
+  struct combine_op {
+    batch_op op;
+    const K* key;
+    Entry* entry;  // for insert_op, the entry to insert
+    bool fresh;    // for upsert_op, if make creates a new entry on each call
+    Entry (*make)(const void*, const std::optional<Entry>&); // for upsert_op
+    const void* constr;  // passed to make
+    std::optional<Entry> result;  // the entry found, if any
+    combine_op* next;
+    std::atomic<bool> done;
+  };
+
+  struct alignas(64) combine_slot {
+    std::atomic<combine_op*> pending = nullptr;
+    std::atomic<bool> taken = false;
+  };
+
+  static constexpr int log_combine_slots = 8;
+  std::vector<combine_slot> combine_slots =
+    std::vector<combine_slot>(combining ? (1 << log_combine_slots) : 0);
+
+  // Publishes the update and waits for it to be applied, by this
+  // thread or another.  Returns the entry found for the key, if any.
+  // For upsert_op, constr points to a function from the old entry (if
+  // any) to the new one.  Must be run within an epoch.
+  template <typename Constr = bool>
+  std::optional<Entry> combine(batch_op op, const K& key, Entry* entry = nullptr,
+			       bool fresh = false, const Constr* constr = nullptr) {
+    combine_op r;
+    r.op = op; r.key = &key; r.entry = entry; r.fresh = fresh;
+    r.make = nullptr; r.constr = constr;
+    if constexpr (!std::is_same_v<Constr, bool>)
+      r.make = [] (const void* c, const std::optional<Entry>& e) -> Entry {
+	return (*(const Constr*) c)(e);};
+    r.done = false;
+    size_t h = Entry::hash(key);
+    combine_slot& slot = combine_slots[(h >> (48 - log_combine_slots)) &
+				       ((1ul << log_combine_slots) - 1)];
+    r.next = slot.pending.load();
+    while (!slot.pending.compare_exchange_weak(r.next, &r)) {}
+    backoff bk(50);
+    while (!r.done.load(std::memory_order_acquire)) {
+      bool not_taken = false;
+      if (!slot.taken.load() && slot.taken.compare_exchange_strong(not_taken, true)) {
+	apply_combined(slot.pending.exchange(nullptr));
+	slot.taken.store(false, std::memory_order_release);
+      } else bk.pause(); // the combiner could be descheduled
+    }
+    return r.result;
+  }
+
+  // Applies a list of published records, grouped by their bucket in
+  // the current version, and marks each done.
+  void apply_combined(combine_op* list) {
+    std::vector<combine_op*> ops;
+    for (; list != nullptr; list = list->next) ops.push_back(list);
+    // published most recent first, so reverse to apply in order
+    std::reverse(ops.begin(), ops.end());
+    apply_combined_groups(current_table_version.load(), ops.data(), ops.size());
+    // the owner can return (and free the record) once done is set
+    for (combine_op* op : ops) op->done.store(true, std::memory_order_release);
+  }
+
+  void apply_combined_groups(table_version* t, combine_op** ops, long m) {
+    std::vector<std::pair<long,combine_op*>> order(m);
+    for (long j = 0; j < m; j++) order[j] = std::pair(t->get_index(*ops[j]->key), ops[j]);
+    std::stable_sort(order.begin(), order.end(), [] (auto& a, auto& b) {
+      return a.first < b.first;});
+    std::vector<combine_op*> sorted(m);
+    for (long j = 0; j < m; j++) sorted[j] = order[j].second;
+    for (long start = 0, end = 0; start < m; start = end) {
+      while (end < m && order[end].first == order[start].first) end++;
+      apply_combined_to_bucket(t, order[start].first, sorted.data() + start, end - start);
+    }
+  }
+
+  // As with apply_to_bucket, but each record has its own kind.  The
+  // entries of inserts belong to their owners, so are never retired
+  // here.  Sizes are counted by the owners.
+  void apply_combined_to_bucket(table_version* t, long idx, combine_op** ops, long m) {
+    bckt* b = &(t->buckets[idx].v);
+    std::vector<Entry> current, created, dropped;
+    backoff bk;
+    while (true) {
+      copy_if_needed(t, idx);
+      auto [s, tag] = b->ll();
+      if (s.is_frozen()) { // wait until forwarded
+	bk.pause();
+	continue;
+      }
+      if (s.is_forwarded()) {
+	apply_combined_groups(t->next.load(), ops, m);
+	return;
+      }
+      current.clear(); created.clear(); dropped.clear();
+      for_each_in_state(s, [&] (const Entry& e) {current.push_back(e);});
+      bool changed = false;
+      for (long j = 0; j < m; j++) {
+	combine_op* op = ops[j];
+	size_t pos = 0;
+	while (pos < current.size() && !current[pos].equal(*op->key)) pos++;
+	bool found = pos < current.size();
+	op->result = found ? std::optional(current[pos]) : std::nullopt;
+	if (op->op == insert_op) {
+	  if (!found) {
+	    current.push_back(*op->entry);
+	    changed = true;
+	  }
+	} else if (op->op == upsert_op) {
+	  Entry e = op->make(op->constr, op->result);
+	  if (op->fresh) created.push_back(e);
+	  if (found) {
+	    dropped.push_back(current[pos]);
+	    current[pos] = e;
+	  } else current.push_back(e);
+	  changed = true;
+	} else if (found) {
+	  dropped.push_back(current[pos]);
+	  current[pos] = current.back();
+	  current.pop_back();
+	  changed = true;
+	}
+      }
+      if (!changed) return;
+      if ((long) current.size() > t->overflow_size) expand_table(t);
+      state new_s;
+      for (const Entry& e : current)
+	new_s = state(new_s, e, [&] (const Entry& e, link* l) {return new_link(e,l);});
+      if (b->sc(tag, new_s)) {
+	retire_list(s.overflow_list());
+	for (Entry& e : dropped) entries_->retire_entry(e);
+	return;
+      }
+      retire_list(new_s.overflow_list());
+      for (Entry& e : created) entries_->retire_entry(e);
+      bk.pause();
+    }
   }
 
   // Size of bucket, or if forwarded, then sum sizes of all forwarded
   // buckets, recursively.
   long bucket_size_rec(table_version* t, long i) {
-    state head = t->buckets[i].v.load();
-    if (!head.is_forwarded())
-      return  head.size();
-    else {
-      long sum = 0;
-      table_version* next = t->next.load();
-      for (int j = 0; j < grow_factor; j++)
-	sum += bucket_size_rec(next, grow_factor * i + j);
-      return sum;
-    }
+    long sum = 0;
+    visit_range(t, t->num_bits, i, [&] (bckt*, const state& s, const auto& keep) {
+      for_each_in_state(s, [&] (const Entry& e) {sum += keep(e);});});
+    return sum;
   }
 
   long size() {
-    table_version* ht = current_table_version.load();
     return epoch::with_epoch([&] {
+       table_version* ht = current_table_version.load();
        return parlay::tabulate_reduce(ht->size, [&] (size_t i) {
 	   return bucket_size_rec(ht, i);});});
   }
 
   template <typename F>
   void for_each_bucket_rec(table_version* t, long i, const F& f) {
-    state s = t->buckets[i].v.load();
-    if (!s.is_forwarded())
-      for_each_in_state(s, f);
-    else {
-      table_version* next = t->next.load();
-      for (int j = 0; j < grow_factor; j++)
-	for_each_bucket_rec(next, grow_factor * i + j, f);
-    }
+    visit_range(t, t->num_bits, i, [&] (bckt*, const state& s, const auto& keep) {
+      for_each_in_state(s, [&] (const Entry& e) {if (keep(e)) f(e);});});
   }
 
   // Apply function f to all entries of the table.  Works while updates are going on, and guarantees that:
@@ -894,32 +2181,69 @@ struct parlay_hash {
   //   any element whose insert linearizes after the response will not be included
   //   any element that is present from invocation to response will be included
   // Elements that are inserted or deleted between the invocation and response might or might not appear.
-  // template <typename F>
-  // parlay::sequence<Entry> entries(const F& f) {
-  //   table_version* ht = current_table_version.load();
-  //   return epoch::with_epoch([&] {
-  //     auto s = parlay::tabulate(ht->size, [&] (size_t i) {
-  //       parlay::sequence<Entry> r;
-  // 	for_each_in_bucket_rec(ht, i, [&] (const Entry& entry) {
-  // 	  r.push_back(f(entry));});
-  // 	return r;});
-  //     return flatten(s);});
-  // }
-
-  // Applies f to all elments in table.
+  // The buckets are split into blocks of traversal_block_size, each
+  // processed by one task, and the results of the blocks are packed.
+  template <typename F>
+  auto entries(const F& f) {
+    using T = typename std::invoke_result<F,Entry>::type;
+    return epoch::with_epoch([&] {
+      table_version* ht = current_table_version.load();
+      return parlay::tabulate_flatten(num_traversal_blocks(ht), [&] (long j) {
+        parlay::sequence<T> r;
+	for_each_in_block(ht, j, [&] (const Entry& entry) {
+	  r.push_back(f(entry));});
+	return r;});});
+  }
+
+  // Applies f to all elments in table, in parallel, so f can be
+  // called concurrently.
   // Same pseudo-linearizable guarantee as entries and size.
   template <typename F>
   void for_each(const F& f) {
-    table_version* ht = current_table_version.load();
     return epoch::with_epoch([&] {
-      for(long i = 0; i < ht->size; i++)
-	for_each_bucket_rec(ht, i, f);});
+      table_version* ht = current_table_version.load();
+      parallel_for(num_traversal_blocks(ht), [&] (long j) {
+	for_each_in_block(ht, j, f);});});
+  }
+
+  // Reduces f(e) over all entries e of the table with the monoid m,
+  // which has an identity and an associative binary operator
+  // (e.g. parlay::plus<long>()), in parallel.
+  // Same pseudo-linearizable guarantee as entries and size.
+  template <typename F, typename Monoid>
+  auto map_reduce(const F& f, const Monoid& m) {
+    return epoch::with_epoch([&] {
+      table_version* ht = current_table_version.load();
+      return parlay::tabulate_reduce(num_traversal_blocks(ht), [&] (long j) {
+	std::remove_cv_t<decltype(m.identity)> r = m.identity;
+	for_each_in_block(ht, j, [&] (const Entry& entry) {
+	  r = m(r, f(entry));});
+	return r;}, m);});
+  }
+
+  // number of buckets processed by one task in traversals
+  static constexpr long traversal_block_size = 1024;
+
+  long num_traversal_blocks(table_version* ht) {
+    return (ht->size + traversal_block_size - 1) / traversal_block_size;
+  }
+
+  template <typename F>
+  void for_each_in_block(table_version* ht, long j, const F& f) {
+    long end = std::min<long>(ht->size, (j + 1) * traversal_block_size);
+    for (long i = j * traversal_block_size; i < end; i++)
+      for_each_bucket_rec(ht, i, f);
   }
 
   // *********************************************
   // Iterator
   // *********************************************
 
+  // An iterator (and its copies) holds the thread in an epoch while it
+  // is alive, so the version it traverses and the entries it returns
+  // are not freed under it.  It must therefore be destroyed by the
+  // thread that created it, and keeping one alive delays the freeing
+  // of any memory retired by other operations.
   struct Iterator {
   public:
     using value_type        = typename Entries::Data;
@@ -929,26 +2253,32 @@ struct parlay_hash {
     using difference_type   = long;
 
   private:
+    std::shared_ptr<epoch::epoch_guard> guard;
     std::vector<Entry> entries;
     Entry entry;
-    table_version* t;
-    int i;
-    long bucket_num;
+    parlay_hash* h = nullptr;
+    table_version* t = nullptr;
+    size_t i = 0;
+    long bucket_num = -1;
     bool single;
     bool end;
     void get_next_bucket() {
-      while (entries.size() == 0 && ++bucket_num < t->size)
-	bucket_entries(t, bucket_num, entries, [] (const Entry& e) {return e;});
-      if (bucket_num == t->size) end = true;
+      while (entries.size() == 0 && ++bucket_num < (long) t->size)
+	h->for_each_bucket_rec(t, bucket_num, [&] (const Entry& e) {entries.push_back(e);});
+      if (bucket_num == (long) t->size) end = true;
     }
 
   public:
     Iterator(bool end) : i(0), bucket_num(-2l), single(false), end(true) {}
-    Iterator(table_version* t) : t(t),
-      i(0), bucket_num(-1l), single(false), end(false) {
+    // the version is loaded after entering the epoch
+    Iterator(parlay_hash* h)
+      : guard(std::make_shared<epoch::epoch_guard>()), h(h),
+	t(h->current_table_version.load()),
+	i(0), bucket_num(-1l), single(false), end(false) {
       get_next_bucket();
     }
-    Iterator(Entry entry) : entry(entry), single(true), end(false) {}
+    Iterator(Entry entry, std::shared_ptr<epoch::epoch_guard> guard)
+      : guard(std::move(guard)), entry(entry), single(true), end(false) {}
     Iterator& operator++() {
       if (single) end = true;
       else if (++i == entries.size()) {
@@ -986,7 +2316,7 @@ struct parlay_hash {
       return !(*this != iterator);}
   };
 
-  Iterator begin() { return Iterator(current_table_version.load());}
+  Iterator begin() { return Iterator(this);}
   Iterator end() { return Iterator(true);}
 
   static constexpr auto identity = [] (const Entry& entry) {return entry;};
@@ -995,9 +2325,16 @@ struct parlay_hash {
   
   template <typename Constr>
   std::pair<Iterator,bool> insert(const K& key, const Constr& constr) {
-    return epoch::with_epoch([&] {
-      auto [e,flag] = insert_(key, constr);
-      return std::pair(Iterator(e), flag);});
+    auto guard = std::make_shared<epoch::epoch_guard>();
+    auto [e,flag] = *insert_(key, constr); // never gives up without a budget
+    // counted as in insert_with, but old versions are not freed since
+    // the guard holds an epoch
+    if (flag) {
+      add_to_size(1);
+      if constexpr (Policy::max_load_factor > 0)
+	if (sampled()) grow_if_dense(current_table_version.load()->get_index(key));
+    }
+    return std::pair(Iterator(e, std::move(guard)), flag);
   }
 
   Iterator erase(Iterator pos) {
@@ -1010,10 +2347,10 @@ struct parlay_hash {
   }
 
   Iterator find(const K& k) {
+    auto guard = std::make_shared<epoch::epoch_guard>();
     auto r = Find(k, identity);
     if (!r.has_value()) return Iterator(true);
-    auto x = Iterator(*r);
-    return x;
+    return Iterator(*r, std::move(guard));
   }
 
 };
@@ -1032,6 +2369,29 @@ struct parlay_hash {
   struct rehash<Hash, typename Hash::is_avalanching> {
     size_t operator()(size_t i) {return i;}};
 
+  // A lookup key together with its hash (after rehash), as returned by
+  // prehash.  It can be passed to Find, Remove and contains of any
+  // table with the same Hash, so the hash is only computed once.  Points
+  // to the key, which must outlive it.  Q can differ from the key type
+  // if Hash and KeyEqual are transparent.
+  template <typename Q>
+  struct hashed_key {
+    const Q* key;
+    size_t hash;
+  };
+
+  // True if Hash and KeyEqual both define is_transparent, in which
+  // case lookups can be made with other types than the key type (e.g.
+  // std::string_view for std::string keys) without constructing a key.
+  template <typename Hash, typename KeyEqual, typename = void>
+  struct is_transparent_lookup : std::false_type {};
+
+  template <typename Hash, typename KeyEqual>
+  struct is_transparent_lookup<Hash, KeyEqual,
+			       std::void_t<typename Hash::is_transparent,
+					   typename KeyEqual::is_transparent>>
+    : std::true_type {};
+
   // Definition where entries of the hash table are stored indirectly
   // through a pointer.  This means the entries themselves will never
   // move, but requires a level of indirection when accessing them.
@@ -1047,7 +2407,7 @@ struct parlay_hash {
       
     struct Entry {
       using K = typename DataS::K;
-      using Key = std::pair<const K*,size_t>;
+      using Key = hashed_key<K>;
       static constexpr bool Direct = false;
       Data* ptr;
       static Data* tag_ptr(size_t hashv, Data* data) {
@@ -1055,15 +2415,19 @@ struct parlay_hash {
       }
       Data* get_ptr() const {
 	return (Data*) (((size_t) ptr) & ((1ul << 48) - 1)); }
-      static unsigned long hash(const Key& k) {
-	return k.second;}
-      bool equal(const Key& k) const {
-	return (((k.second >> 48) == (((size_t) ptr) >> 48)) &&
-		KeyEqual{}(DataS::get_key(*get_ptr()), *k.first)); }
+      template <typename Q>
+      static unsigned long hash(const hashed_key<Q>& k) {
+	return k.hash;}
+      template <typename Q>
+      bool equal(const hashed_key<Q>& k) const {
+	return (((k.hash >> 48) == (((size_t) ptr) >> 48)) &&
+		KeyEqual{}(DataS::get_key(*get_ptr()), *k.key)); }
       Key get_key() const { return make_key(DataS::get_key(*get_ptr()));}
       Data& get_entry() const { return *get_ptr();}
-      static Key make_key(const K& key) {
-	return Key(&key, rehash<Hash>{}(Hash{}(key)));}
+      static Key make_key(const K& key) { return prehash(key);}
+      template <typename Q>
+      static hashed_key<Q> prehash(const Q& key) {
+	return hashed_key<Q>{&key, rehash<Hash>{}(Hash{}(key))};}
       Entry(Key k, Data* data) : ptr(tag_ptr(hash(k), data)) {}
       Entry() {}
     };
@@ -1087,17 +2451,95 @@ struct parlay_hash {
     Entry make_entry(const Key& k, const Data& data) {
       return Entry(k, data_pool->New(data)); }
 
+    // allocates memory for the entry and constructs it in place from args
+    template <typename... Args>
+    Entry emplace_entry(const Key& k, Args&&... args) {
+      return Entry(k, data_pool->New(std::forward<Args>(args)...)); }
+
     // retires the memory for the entry
     void retire_entry(Entry& e) {
       data_pool->Retire(e.get_ptr()); }
   };
 
+  // As IndirectEntries, but with a copy of the key kept inline next to
+  // each pointer, so each slot of a bucket is a {key, pointer} pair and
+  // the entry (which still holds its own key) is only dereferenced when
+  // the key matches.  Compared to IndirectEntries this saves a cache
+  // miss per non-matching key, but not the space of the pointers in the
+  // scanned lines, and the key is stored twice.  Keys must be trivially
+  // copyable since they can be moved by updates.
+  template <typename EntryData>
+  struct InlineKeyEntries {
+    using DataS = EntryData;
+    using Data = typename DataS::value_type;
+    using Hash = typename DataS::Hash;
+    using KeyEqual = typename DataS::KeyEqual;
+    using K = typename DataS::K;
+    static_assert(std::is_trivially_copyable_v<K>,
+		  "InlineKeyEntries requires a trivially copyable key");
+
+    struct Entry {
+      using K = typename DataS::K;
+      using Key = K;
+      static constexpr bool Direct = false;
+      K key;
+      Data* ptr;
+      static unsigned long hash(const Key& k) {
+	return rehash<Hash>{}(Hash{}(k));}
+      bool equal(const Key& k) const { return KeyEqual{}(key, k); }
+      static Key make_key(const K& k) {return k;}
+      const K& get_key() const {return key;}
+      Data& get_entry() const { return *ptr;}
+      template <typename Q>
+      static unsigned long hash(const hashed_key<Q>& k) {
+	return k.hash;}
+      template <typename Q>
+      bool equal(const hashed_key<Q>& k) const {
+	return KeyEqual{}(key, *k.key); }
+      template <typename Q>
+      static hashed_key<Q> prehash(const Q& k) {
+	return hashed_key<Q>{&k, rehash<Hash>{}(Hash{}(k))};}
+      Entry(const K& k, Data* data) : key(k), ptr(data) {}
+      Entry() {}
+    };
+
+    bool clear_at_end;
+
+    // a memory pool for the entries
+    epoch::memory_pool<Data>* data_pool;
+
+    InlineKeyEntries(bool clear_at_end=false)
+      : clear_at_end(clear_at_end),
+	data_pool(clear_at_end ?
+		  new epoch::memory_pool<Data>() :
+		  &epoch::get_default_pool<Data>()) {}
+    ~InlineKeyEntries() {
+      if (clear_at_end) { delete data_pool;}
+    }
+
+    Entry make_entry(const K& k, const Data& data) {
+      return Entry(k, data_pool->New(data)); }
+
+    template <typename... Args>
+    Entry emplace_entry(const K& k, Args&&... args) {
+      return Entry(k, data_pool->New(std::forward<Args>(args)...)); }
+
+    void retire_entry(Entry& e) {
+      data_pool->Retire(e.ptr); }
+  };
+
   // Definition where entries of the hash table are stored directly.
   // This means the entries might be moved during updates, including
   // insersions, removals, and resizing.  Currently used for trivially
   // copyable types.
-  template <typename EntryData>
+  // If Fingerprints is set, each bucket also keeps a one byte
+  // fingerprint of the hash of each key in its buffer, so lookups only
+  // compare keys whose fingerprints match.  This helps when comparing
+  // keys is expensive, or many lookups are for keys that are not
+  // present, at the cost of a slightly smaller buffer.
+  template <typename EntryData, bool Fingerprints = false>
   struct DirectEntries {
+    static constexpr bool fingerprints = Fingerprints;
     using DataS = EntryData;
     using Data = typename DataS::value_type;
     using Hash = typename DataS::Hash;
@@ -1113,6 +2555,15 @@ struct parlay_hash {
 	return rehash<Hash>{}(Hash{}(k));}
       bool equal(const Key& k) const { return KeyEqual{}(get_key(), k); }
       static Key make_key(const K& k) {return k;}
+      template <typename Q>
+      static unsigned long hash(const hashed_key<Q>& k) {
+	return k.hash;}
+      template <typename Q>
+      bool equal(const hashed_key<Q>& k) const {
+	return KeyEqual{}(get_key(), *k.key); }
+      template <typename Q>
+      static hashed_key<Q> prehash(const Q& k) {
+	return hashed_key<Q>{&k, rehash<Hash>{}(Hash{}(k))};}
       const K& get_key() const {return DataS::get_key(data);}
       const Data& get_entry() const { return data;}
       Entry(const Data& data) : data(data) {}
@@ -1122,6 +2573,9 @@ struct parlay_hash {
     DirectEntries(bool clear_at_end=false) {}
     Entry make_entry(const K& k, const Data& data) {
       return Entry(data); }
+    template <typename... Args>
+    Entry emplace_entry(const K&, Args&&... args) {
+      return Entry(Data(std::forward<Args>(args)...)); }
 
     // retiring is a noop since no memory has been allocated for entries
     void retire_entry(Entry& e) {}
@@ -0,0 +1,173 @@
+// A concurrent map from strings to values that stores short keys
+// inline in the buckets.  On a value type V it supports:
+//
+//   parlay_string_map<V, N=23, Policy=default_hash_policy>(n, clear_at_end) :
+//   constructor for a map of initial size n.
+//
+//   Find(std::string_view) -> std::optional<V>
+//   Insert(std::string_view, const V&) -> std::optional<V>
+//   Upsert(std::string_view, (const std::optional<V>&) -> V) -> std::optional<V>
+//   Remove(std::string_view) -> std::optional<V>
+//   FindOrCompute(std::string_view, () -> V) -> V
+//   contains(std::string_view) -> bool
+//   size() -> long, empty() -> bool, clear() -> void
+//   for_each(F f) : applies f(std::string_view, const V&) to each entry
+//
+// with the same meaning as for parlay_unordered_map.
+//
+// Keys of at most N characters are kept as an inline_string<N> in a
+// map of their own, which stores them directly in the buckets (if V
+// is trivially copyable), so finding them takes one cache miss and no
+// allocation.  Longer keys go to a second map with std::string keys
+// and indirect entries.  Lookups of either kind take a string_view and
+// do not construct a std::string.
+//
+// inline_string<N> and inline_string_hash can also be used on their
+// own as the key type and Hash of a parlay_unordered_map.  The hash
+// defines is_avalanching, so it is not rehashed.
+
+#ifndef PARLAY_STRING_MAP_
+#define PARLAY_STRING_MAP_
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include "unordered_map.h"
+
+namespace parlay {
+
+  // A string of at most N characters stored inline, so it is
+  // trivially copyable and can be kept in a bucket.  Unused
+  // characters are zero.
+  template <int N = 23>
+  struct inline_string {
+    static_assert(N > 0 && N < 256, "inline_string holds at most 255 characters");
+    static constexpr long capacity = N;
+    char chars[N];
+    unsigned char len;
+
+    static bool fits(std::string_view s) { return s.size() <= N; }
+
+    inline_string() : len(0) { std::memset(chars, 0, N); }
+    // s must fit
+    explicit inline_string(std::string_view s) : len((unsigned char) s.size()) {
+      std::memset(chars, 0, N);
+      std::memcpy(chars, s.data(), s.size());
+    }
+
+    long size() const { return len;}
+    const char* data() const { return chars;}
+    std::string_view view() const { return std::string_view(chars, len);}
+    operator std::string_view() const { return view();}
+
+    // since unused characters are zero, can compare all bytes at once
+    bool operator==(const inline_string& o) const {
+      return std::memcmp(this, &o, sizeof(inline_string)) == 0;}
+    bool operator!=(const inline_string& o) const { return !(*this == o);}
+  };
+
+  // Hashes the characters 8 at a time, and mixes the result so all
+  // bits are well distributed (hence is_avalanching).  Strings and
+  // inline_strings with the same characters hash the same, so it is
+  // transparent.
+  struct inline_string_hash {
+    using is_avalanching = void;
+    using is_transparent = void;
+
+    static uint64_t mix(uint64_t x) {
+      x ^= x >> 33;
+      x *= UINT64_C(0xff51afd7ed558ccd);
+      x ^= x >> 33;
+      x *= UINT64_C(0xc4ceb9fe1a85ec53);
+      return x ^ (x >> 33);
+    }
+
+    size_t operator()(std::string_view s) const {
+      const char* p = s.data();
+      size_t n = s.size();
+      uint64_t h = n * UINT64_C(0x9e3779b97f4a7c15);
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8) {
+	uint64_t w;
+	std::memcpy(&w, p + i, 8);
+	h = mix(h ^ w);
+      }
+      uint64_t w = 0;
+      std::memcpy(&w, p + i, n - i);
+      return mix(h ^ w);
+    }
+  };
+
+  // Compares any mix of strings and inline_strings by their characters.
+  struct inline_string_equal {
+    using is_transparent = void;
+    bool operator()(std::string_view a, std::string_view b) const { return a == b;}
+    template <int N>
+    bool operator()(const inline_string<N>& a, const inline_string<N>& b) const {
+      return a == b;}
+  };
+
+  template <typename V, int N = 23, class Policy = default_hash_policy>
+  struct parlay_string_map {
+    using short_key = inline_string<N>;
+    using short_map = parlay_unordered_map<short_key, V, inline_string_hash,
+					   inline_string_equal, Policy>;
+    using long_map = parlay_unordered_map_indirect<std::string, V, inline_string_hash,
+						   inline_string_equal, Policy>;
+    using mapped_type = V;
+
+    short_map shorts;
+    long_map longs;
+
+    // long keys are expected to be rare, so their map starts small
+    // and grows as needed
+    parlay_string_map(long n, bool clear_at_end = default_clear_at_end)
+      : shorts(n, clear_at_end), longs(std::max<long>(n / 16, 16), clear_at_end) {}
+
+    std::optional<V> Find(std::string_view k) {
+      if (short_key::fits(k)) return shorts.Find(short_key(k));
+      return longs.Find(k);
+    }
+
+    bool contains(std::string_view k) {
+      if (short_key::fits(k)) return shorts.contains(short_key(k));
+      return longs.contains(k);
+    }
+
+    std::optional<V> Insert(std::string_view k, const V& v) {
+      if (short_key::fits(k)) return shorts.Insert(short_key(k), v);
+      return longs.Insert(std::string(k), v);
+    }
+
+    template <typename F>
+    std::optional<V> Upsert(std::string_view k, const F& f) {
+      if (short_key::fits(k)) return shorts.Upsert(short_key(k), f);
+      return longs.Upsert(std::string(k), f);
+    }
+
+    template <typename F>
+    V FindOrCompute(std::string_view k, const F& f) {
+      if (short_key::fits(k)) return shorts.FindOrCompute(short_key(k), f);
+      return longs.FindOrCompute(std::string(k), f);
+    }
+
+    std::optional<V> Remove(std::string_view k) {
+      if (short_key::fits(k)) return shorts.Remove(short_key(k));
+      return longs.Remove(k);
+    }
+
+    long size() { return shorts.size() + longs.size();}
+    bool empty() { return shorts.empty() && longs.empty();}
+    void clear() { shorts.clear(); longs.clear();}
+
+    template <typename F>
+    void for_each(const F& f) {
+      shorts.for_each([&] (const auto& kv) {f(kv.first.view(), kv.second);});
+      longs.for_each([&] (const auto& kv) {f(std::string_view(kv.first), kv.second);});
+    }
+  };
+
+}  // namespace parlay
+#endif  // PARLAY_STRING_MAP_
@@ -4,38 +4,153 @@
 // A growable unordered_map using a hash table designed for scalability to large number of threads, and
 // for high contention.  On a key type K and value type V it supports:
 //
-//   unordered_map<K, V, Hash=std::hash<K>, Equal=std::equal_to<K>>(n) :
-//   constructor for table of initial size n
+//   unordered_map<K, V, Hash=std::hash<K>, Equal=std::equal_to<K>,
+//     Policy=default_hash_policy>(n, clear_at_end, background_migration=false) :
+//   constructor for table of initial size n.  If background_migration
+//   is set, a helper thread copies the table when it is resized.  The
+//   Policy sets the size of the table and when it grows and shrinks.
 //
 //   Find(const K&) -> std::optional<V> :
 //   returns value if key is found, and otherwise returns nullopt
 //
+//   FindRef(const K&) -> value_ref :
+//   like Find but returns a guard that converts to true if the key is
+//   found, and then gives a const reference to the value with *.  The
+//   value is not copied, and the reference remains valid until the
+//   guard is destroyed.  Must be destroyed by the same thread.  Any
+//   number can be held at once.
+//
+//   prehash(const K&) -> hashed_key<K> :
+//   returns the key with its hash, which can be passed to Find, Remove
+//   and contains instead of the key, on any map with the same Hash, so
+//   the hash is only computed once.  If Hash and Equal are transparent
+//   (define is_transparent), these also accept keys of other types.
+//
 //   Insert(const K&, const V&) -> std::optional<V> :
 //   if key not in the table it inserts the key with the given value
 //   and returns nullopt, otherwise it does not modify the table and
 //   returns the old value.
 //
+//   Emplace(const K&, Args&&...) -> bool :
+//   if key not in the table it inserts the key with a value constructed
+//   in place from args, and returns true, otherwise returns false
+//   without constructing a value.  Works with move-only values.
+//
+//   InsertOrAssign(const K&, Args&&...) -> bool :
+//   constructs a value in place from args and inserts it, replacing
+//   the value if the key is already in the table.  Returns true if
+//   inserted.
+//
+//   FindOrCompute(const K&, () -> V) -> V :
+//   returns the value of the key if it is in the table, and otherwise
+//   computes one with f(), inserts it and returns it.  Concurrent calls
+//   on the same key call f once: the first claims the key and the
+//   others wait for its value.  If f throws, the exception is passed
+//   on and a waiting call claims the key instead.  Other operations do
+//   not see the key until its value is inserted.
+//
+//   TryFind(const K&, long max_tries) -> try_result<std::optional<V>>
+//   TryInsert(const K&, const V&, long max_tries) -> try_result<std::optional<V>>
+//   TryUpsert(const K&, (const std::optional<V>&) -> V, long max_tries)
+//     -> try_result<std::optional<V>>
+//   TryRemove(const K&, long max_tries) -> try_result<std::optional<V>> :
+//   like Find, Insert, Upsert and Remove, but they give up after
+//   max_tries (at least 1) attempts that fail because of other updates
+//   to the bucket, or because a resize is copying it, rather than
+//   retry until they succeed.  The result converts to false if the
+//   operation gave up (and it had no effect), and otherwise * gives
+//   what the operation without Try returns.
+//
+//   FindBatch(const Keys&, Out&&) -> void :
+//   for a random access range of keys, sets out[i] to Find(keys[i]).
+//   Faster than separate Finds since the cache misses overlap.
+//
+//   InsertBatch(const KVs&, Out&&) -> void :
+//   for a random access range of key-value pairs, inserts each as
+//   Insert does and sets out[i] to what Insert(kvs[i].first,
+//   kvs[i].second) would return.  Operations on the same bucket are
+//   applied together.
+//
+//   UpsertBatch(const Keys&, (long, std::optional<V>) -> V, Out&&) -> void :
+//   batched version of Upsert, where the function is also passed the
+//   index i of the key.
+//
+//   RemoveBatch(const Keys&, Out&&) -> void :
+//   batched version of Remove.
+//
 //   Remove(const K&) -> std::optional<V> :
 //   if key is in the table it removes the entry and returns its value.
 //   otherwise it does nothing and returns nullopt.
 //
+//   build(const KVs&) -> void : replaces the contents of the table
+//   with a random access range of key-value pairs, in parallel.  Much
+//   faster than inserting one at a time, but cannot run concurrently
+//   with other operations.  If a key appears more than once, the
+//   first is kept.
+//
 //   size() -> long : returns the size of the table.  Not linearizable with
 //   the other functions, and takes time proportional to the table size.
+//
+//   size_estimate() -> long : returns the size of the table from
+//   per-thread counts if the Policy has count_size set, which takes
+//   time proportional to the number of threads, and otherwise size().
+//   Exact when there are no concurrent updates.
+//
+//   empty() -> bool : true if the table has no entries.  Uses the
+//   per-thread counts if the Policy has count_size set.
 //  
 //   clear() -> void : clears the table so its size is 0.
 //
-//   for_each(F f) : applies functor f to each entry of the table.
+//   shrink_to_fit() -> void : shrinks the table to fit its current
+//   size.  If the policy sets reclaim_versions, frees the memory of
+//   older versions, and the table also shrinks on its own when
+//   removes leave it sparse.
+//
+//   reserve(long n) -> void : grows the table, if needed, to the size
+//   for n entries, copying the entries once.
+//
+//   for_each(F f) : applies functor f to each entry of the table, in
+//   parallel, so f can be called concurrently.
 //   f should be of type (const std::pair<K,V>&) -> void
+//
+//   map_reduce(F f, Monoid m) : reduces f(kv) over all entries kv of
+//   the table with the monoid m (e.g. parlay::plus<long>()), in parallel.
+//
+//   entries(F f = identity) -> parlay::sequence : returns f(kv) for all
+//   entries kv of the table, computed in parallel.
+//
+//   for_each, map_reduce and entries have the same guarantee as size():
+//   entries that are not updated during the call are each included once.
 
 #ifndef PARLAY_UNORDERED_MAP_
 #define PARLAY_UNORDERED_MAP_
 
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <utils/backoff.h>
 #include "parlay_hash.h"
 
 namespace parlay {
 
+  // A claim on a key by FindOrCompute, which the other calls on the
+  // key wait on until the value is inserted.
+  struct compute_flight {
+    std::atomic<bool> done = false;
+    void wait() {
+      backoff bk;
+      while (!done.load()) bk.pause_on(done, false);
+    }
+    void finish() {
+      done = true;
+      backoff::wake(done);
+    }
+  };
+
   // entries contain a key
   template <typename K_, typename V_, class Hash_ = std::hash<K_>, class KeyEqual_ = std::equal_to<K_>>
   struct MapData {
@@ -49,9 +164,9 @@ namespace parlay {
 
   // Generic unordered_map that can be used with direct or indirect
   // entries depending on the template argument.
-  template <typename Entries>
+  template <typename Entries, typename Policy = default_hash_policy>
   struct unordered_map_internal {
-    using map = parlay_hash<Entries>;
+    using map = parlay_hash<Entries, Policy>;
 
     Entries entries_;
     map m;
@@ -63,26 +178,95 @@ namespace parlay {
     using mapped_type = V;
     using value_type = std::pair<K, V>;
     using iterator = typename map::Iterator;
+    using Hash = typename Entries::Hash;
+    using KeyEqual = typename Entries::KeyEqual;
+
+    // enables lookups with keys of type Q other than K
+    template <typename Q, typename H = Hash>
+    using if_lookup_key = std::enable_if_t<!std::is_same_v<Q, K> &&
+					   is_transparent_lookup<H, KeyEqual>::value, int>;
 
     static constexpr auto true_f = [] (const Entry& kv) {return true;};
     static constexpr auto identity = [] (const Entry& kv) {return kv;};
-    static constexpr auto get_value = [] (const value_type& kv) {return kv.second;};
+    // generic, so the value is only copied if they are used, which
+    // allows move-only values
+    static constexpr auto get_value = [] (const auto& kv) -> V {return kv.second;};
+    static constexpr auto get_pair = [] (const auto& kv) -> value_type {return kv;};
+
+    // Keys being computed by FindOrCompute, with their claims.
+    // Allocated on first use.
+    using flight_map = unordered_map_internal<IndirectEntries<MapData<K, std::shared_ptr<compute_flight>,
+									Hash, KeyEqual>>>;
+    std::atomic<flight_map*> flights_ = nullptr;
+
+    flight_map& flights() {
+      flight_map* f = flights_.load();
+      if (f != nullptr) return *f;
+      flight_map* nf = new flight_map(16, false);
+      if (flights_.compare_exchange_strong(f, nf)) return *nf;
+      delete nf;
+      return *f;
+    }
 
-    unordered_map_internal(long n, bool clear_at_end = default_clear_at_end)
+    unordered_map_internal(long n, bool clear_at_end = default_clear_at_end,
+			   bool background_migration = false)
       : entries_(Entries(clear_at_end)),
-	m(map(n, &entries_, clear_at_end)) {}
+	m(map(n, &entries_, clear_at_end, background_migration)) {}
+
+    ~unordered_map_internal() { delete flights_.load();}
     
     iterator begin() { return m.begin();}
     iterator end() { return m.end();}
-    bool empty() { return size() == 0;}
+    bool empty() { return m.empty();}
     bool max_size() { return (1ul << 47)/sizeof(Entry);}
     void clear() { m.clear_buckets();}
     long size() { return m.size();}
+    long size_estimate() { return m.size_estimate();}
+    void shrink_to_fit() { m.shrink_to_fit();}
+    void reserve(long n) { m.reserve(n);}
+
+    // A sequence with f(kv) for each key-value pair kv in the table.
+    template <typename F = decltype(get_pair)>
+    auto entries(const F& f = get_pair) {
+      return m.entries([&] (const Entry& e) {return f(e.get_entry());});}
+
+    template <typename F>
+    void for_each(const F& f) {
+      m.for_each([&] (const Entry& e) {f(e.get_entry());});}
+
+    template <typename F, typename Monoid>
+    auto map_reduce(const F& f, const Monoid& monoid) {
+      return m.map_reduce([&] (const Entry& e) {return f(e.get_entry());}, monoid);}
 
-    template <typename F = decltype(identity)>
-    //auto entries(const F& f = identity) { return m.entries(f);}
     long count(const K& k) { return (contains(k)) ? 1 : 0; }
-    bool contains(const K& k) { return find(k, true_f).has_value();}
+    bool contains(const K& k) { return m.Find(Entry::make_key(k), true_f).has_value();}
+
+    template <typename Q>
+    bool contains(const hashed_key<Q>& k) { return m.Find(k, true_f).has_value();}
+
+    template <typename Q, if_lookup_key<Q> = 0>
+    bool contains(const Q& k) { return contains(Entry::prehash(k));}
+
+    // The key with its hash, which can be used for lookups in any map
+    // with the same Hash.  Can be of type Q if Hash and KeyEqual are
+    // transparent.
+    static hashed_key<K> prehash(const K& k) { return Entry::prehash(k);}
+
+    template <typename Q, if_lookup_key<Q> = 0>
+    static hashed_key<Q> prehash(const Q& k) { return Entry::prehash(k);}
+
+    // Returned by FindRef.  Holds an epoch, and the entry found if
+    // any, so the reference to its value stays valid, and the value
+    // is not copied, until it is destroyed.
+    struct value_ref {
+      epoch::epoch_guard guard;
+      std::optional<Entry> entry;
+      explicit operator bool() const { return entry.has_value();}
+      bool has_value() const { return entry.has_value();}
+      const K& key() const { return entry->get_entry().first;}
+      const V& operator*() const { return entry->get_entry().second;}
+      const V* operator->() const { return &(entry->get_entry().second);}
+    };
 
     template <typename F = decltype(get_value)>
     auto Find(const K& k, const F& f = get_value)
@@ -92,11 +276,39 @@ namespace parlay {
       return m.Find(Entry::make_key(k), g);
     }
 
+    template <typename Q, typename F = decltype(get_value)>
+    auto Find(const hashed_key<Q>& k, const F& f = get_value)
+      -> std::optional<typename std::result_of<F(value_type)>::type>
+    {
+      auto g = [&] (const Entry& e) {return f(e.get_entry());};
+      return m.Find(k, g);
+    }
+
+    template <typename Q, typename F = decltype(get_value), if_lookup_key<Q> = 0>
+    auto Find(const Q& k, const F& f = get_value)
+      -> std::optional<typename std::result_of<F(value_type)>::type>
+    { return Find(Entry::prehash(k), f); }
+
+    value_ref FindRef(const K& k) {
+      value_ref r;
+      r.entry = m.Find(Entry::make_key(k), identity);
+      return r;
+    }
+
+    // out[i] is set to Find(keys[i], f) for each i.  out must be
+    // indexable and have at least keys.size() elements.
+    template <typename Keys, typename Out, typename F = decltype(get_value)>
+    void FindBatch(const Keys& keys, Out&& out, const F& f = get_value) {
+      auto g = [&] (const Entry& e) {return f(e.get_entry());};
+      m.FindBatch(keys.size(), [&] (long i) -> decltype(auto) {return keys[i];}, g,
+		  [&] (long i, auto&& r) {out[i] = std::move(r);});
+    }
+
     auto Insert(const K& key, const V& value) -> std::optional<mapped_type>
     {
       auto k = Entry::make_key(key);
       auto g = [&] (const Entry& e) {return get_value(e.get_entry());};
-      return m.Insert(k, [&] {return entries_.make_entry(k, value_type(key, value));}, g);
+      return m.Insert(k, [&] {return entries_.emplace_entry(k, key, value);}, g);
     }
 
     template <typename F>
@@ -106,8 +318,8 @@ namespace parlay {
       auto g = [&] (const Entry& e) {return get_value(e.get_entry());};
       auto constr = [&] (const std::optional<Entry>& e) -> Entry {
 		      if (e.has_value())
-			return entries_.make_entry(k, value_type(key, f(std::optional(get_value((*e).get_entry())))));
-		      return entries_.make_entry(k, value_type(key, f(std::optional<V>())));
+			return entries_.emplace_entry(k, key, f(std::optional(get_value((*e).get_entry()))));
+		      return entries_.emplace_entry(k, key, f(std::optional<V>()));
 		    };
       return m.Upsert(k, constr, g);
     }
@@ -118,7 +330,64 @@ namespace parlay {
     {
       auto k = Entry::make_key(key);
       auto g = [&] (const Entry& e) {return f(e.get_entry());};
-      return m.Insert(k, [&] {return entries_.make_entry(k, value_type(key, value));}, g);
+      return m.Insert(k, [&] {return entries_.emplace_entry(k, key, value);}, g);
+    }
+
+    // Constructs the value from args in place, and only if the key
+    // is not already in the table.  Returns true if inserted.
+    template <typename... Args>
+    bool Emplace(const K& key, Args&&... args) {
+      auto k = Entry::make_key(key);
+      return !m.Insert(k, [&] {
+	  return entries_.emplace_entry(k, std::piecewise_construct,
+					std::forward_as_tuple(key),
+					std::forward_as_tuple(std::forward<Args>(args)...));},
+	true_f).has_value();
+    }
+
+    // The claim is made in a separate map of the keys being computed,
+    // so keys of the table never hold a placeholder.  After claiming,
+    // the key is looked up again since a value might have been inserted
+    // (and its claim released) since the first lookup.
+    template <typename F>
+    V FindOrCompute(const K& key, const F& f) {
+      while (true) {
+	if (std::optional<V> r = Find(key)) return *r;
+	auto fl = std::make_shared<compute_flight>();
+	if (auto other = flights().Insert(key, fl)) {
+	  (*other)->wait();
+	  continue;
+	}
+	auto release = [&] {
+	  flights().Remove(key);
+	  fl->finish();
+	};
+	std::optional<V> r = Find(key);
+	if (!r.has_value()) {
+	  try {
+	    V v = f();
+	    r = Insert(key, v);
+	    if (!r.has_value()) r = std::move(v);
+	  } catch (...) {
+	    release();
+	    throw;
+	  }
+	}
+	release();
+	return *r;
+      }
+    }
+
+    // Constructs the value from args in place, once, and inserts it
+    // or replaces the value if the key is already in the table.
+    // Returns true if inserted.
+    template <typename... Args>
+    bool InsertOrAssign(const K& key, Args&&... args) {
+      auto k = Entry::make_key(key);
+      Entry e = entries_.emplace_entry(k, std::piecewise_construct,
+				       std::forward_as_tuple(key),
+				       std::forward_as_tuple(std::forward<Args>(args)...));
+      return !m.Assign(k, e, true_f).has_value();
     }
 
     auto Remove(const K& k) -> std::optional<mapped_type>
@@ -135,7 +404,102 @@ namespace parlay {
       return m.Remove(Entry::make_key(k), g);
     }
 
-    iterator find(const K& k) { return m.find(k); }
+    template <typename Q, typename F = decltype(get_value)>
+    auto Remove(const hashed_key<Q>& k, const F& f = get_value)
+      -> std::optional<typename std::result_of<F(value_type)>::type>
+    {
+      auto g = [&] (const Entry& e) {return f(e.get_entry());};
+      return m.Remove(k, g);
+    }
+
+    template <typename Q, typename F = decltype(get_value), if_lookup_key<Q> = 0>
+    auto Remove(const Q& k, const F& f = get_value)
+      -> std::optional<typename std::result_of<F(value_type)>::type>
+    { return Remove(Entry::prehash(k), f); }
+
+    try_result<std::optional<V>> TryFind(const K& k, long max_tries) {
+      auto g = [&] (const Entry& e) {return get_value(e.get_entry());};
+      return m.TryFind(Entry::make_key(k), g, max_tries);
+    }
+
+    try_result<std::optional<V>> TryInsert(const K& key, const V& value, long max_tries) {
+      auto k = Entry::make_key(key);
+      auto g = [&] (const Entry& e) {return get_value(e.get_entry());};
+      return m.TryInsert(k, [&] {return entries_.emplace_entry(k, key, value);}, g, max_tries);
+    }
+
+    template <typename F>
+    try_result<std::optional<V>> TryUpsert(const K& key, const F& f, long max_tries) {
+      auto k = Entry::make_key(key);
+      auto g = [&] (const Entry& e) {return get_value(e.get_entry());};
+      auto constr = [&] (const std::optional<Entry>& e) -> Entry {
+		      if (e.has_value())
+			return entries_.emplace_entry(k, key, f(std::optional(get_value((*e).get_entry()))));
+		      return entries_.emplace_entry(k, key, f(std::optional<V>()));
+		    };
+      return m.TryUpsert(k, constr, g, max_tries);
+    }
+
+    try_result<std::optional<V>> TryRemove(const K& k, long max_tries) {
+      auto g = [&] (const Entry& e) {return get_value(e.get_entry());};
+      return m.TryRemove(Entry::make_key(k), g, max_tries);
+    }
+
+    // The key of kvs[i], as a reference if kvs[i] is one, and otherwise
+    // copied out of the temporary that kvs[i] returns.
+    template <typename KVs>
+    static decltype(auto) key_of(const KVs& kvs, long i) {
+      if constexpr (std::is_lvalue_reference_v<decltype(kvs[i])>) return (kvs[i].first);
+      else return K(kvs[i].first);
+    }
+
+    // Batched versions of Insert, Upsert and Remove.  Operations are
+    // sorted by bucket and all those on a bucket are applied with a
+    // single update to the bucket.  out[i] is set to the result of the
+    // i-th operation.  Operations on the same key are applied in order.
+    template <typename KVs, typename Out>
+    void InsertBatch(const KVs& kvs, Out&& out) {
+      auto g = [&] (const Entry& e) {return get_value(e.get_entry());};
+      m.InsertBatch(kvs.size(),
+		    [&] (long i) -> decltype(auto) {return key_of(kvs, i);},
+		    [&] (long i) {
+		      return entries_.emplace_entry(Entry::make_key(kvs[i].first),
+						    kvs[i].first, kvs[i].second);},
+		    g, [&] (long i, auto&& r) {out[i] = std::move(r);});
+    }
+
+    template <typename Keys, typename F, typename Out>
+    void UpsertBatch(const Keys& keys, const F& f, Out&& out) {
+      auto g = [&] (const Entry& e) {return get_value(e.get_entry());};
+      auto constr = [&] (long i, const std::optional<Entry>& e) -> Entry {
+		      auto k = Entry::make_key(keys[i]);
+		      if (e.has_value())
+			return entries_.emplace_entry(k, keys[i], f(i, std::optional(get_value((*e).get_entry()))));
+		      return entries_.emplace_entry(k, keys[i], f(i, std::optional<V>()));
+		    };
+      m.UpsertBatch(keys.size(), [&] (long i) -> decltype(auto) {return keys[i];},
+		    constr, g, [&] (long i, auto&& r) {out[i] = std::move(r);});
+    }
+
+    template <typename Keys, typename Out>
+    void RemoveBatch(const Keys& keys, Out&& out) {
+      auto g = [&] (const Entry& e) {return get_value(e.get_entry());};
+      m.RemoveBatch(keys.size(), [&] (long i) -> decltype(auto) {return keys[i];},
+		    g, [&] (long i, auto&& r) {out[i] = std::move(r);});
+    }
+
+    // Replaces the contents with the key-value pairs in kvs.  Must not
+    // be run concurrently with other operations on the map.
+    template <typename KVs>
+    void build(const KVs& kvs) {
+      m.build(kvs.size(),
+	      [&] (long i) -> decltype(auto) {return key_of(kvs, i);},
+	      [&] (long i) {
+		return entries_.emplace_entry(Entry::make_key(kvs[i].first),
+					      kvs[i].first, kvs[i].second);});
+    }
+
+    iterator find(const K& k) { return m.find(Entry::make_key(k)); }
 
     std::pair<iterator,bool> insert(const value_type& entry) {
       auto k = Entry::make_key(entry.first);
@@ -149,22 +513,41 @@ namespace parlay {
   // Entries are stored directly in the bucket, avoiding a cache miss
   // for indirection.  Entries can be moved by updates even on
   // different keys.
-  template <typename K, typename V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>>
-  using parlay_unordered_map_direct = unordered_map_internal<DirectEntries<MapData<K, V, Hash, KeyEqual>>>;
+  template <typename K, typename V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>,
+	    class Policy = default_hash_policy>
+  using parlay_unordered_map_direct = unordered_map_internal<DirectEntries<MapData<K, V, Hash, KeyEqual>>, Policy>;
+
+  // Direct entries where each bucket also keeps a one byte fingerprint
+  // of each key in its buffer, so a lookup only compares the keys
+  // with matching fingerprints.
+  template <typename K, typename V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>,
+	    class Policy = default_hash_policy>
+  using parlay_unordered_map_fingerprint = unordered_map_internal<DirectEntries<MapData<K, V, Hash, KeyEqual>, true>, Policy>;
 
   // Entries are stored indirectly through a pointer.  Pointers to
   // entries wil remain valid until the entry is upserted or deleted
   // (an upsert can be though of as a deletion followed by an
   // insersion).
-  template <typename K, typename V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>>
-  using parlay_unordered_map_indirect = unordered_map_internal<IndirectEntries<MapData<K, V, Hash, KeyEqual>>>;
+  template <typename K, typename V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>,
+	    class Policy = default_hash_policy>
+  using parlay_unordered_map_indirect = unordered_map_internal<IndirectEntries<MapData<K, V, Hash, KeyEqual>>, Policy>;
+
+  // As parlay_unordered_map_indirect, but with a copy of each key kept
+  // in the bucket next to the pointer to its key-value pair, so finding
+  // a key only dereferences the pair that matches.  Requires a
+  // trivially copyable key.  Pointers to entries remain valid as for
+  // parlay_unordered_map_indirect.
+  template <typename K, typename V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>,
+	    class Policy = default_hash_policy>
+  using parlay_unordered_map_inline_key = unordered_map_internal<InlineKeyEntries<MapData<K, V, Hash, KeyEqual>>, Policy>;
 
   // specialization of unordered_map to use either direct or indirect
   // entries depending on whether K and V are trivially copyable.
-  template <typename K, typename V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>>
+  template <typename K, typename V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>,
+	    class Policy = default_hash_policy>
   using parlay_unordered_map = std::conditional_t<std::is_trivially_copyable_v<K> &&
 						  std::is_trivially_copyable_v<V>,
-						  parlay_unordered_map_direct<K,V,Hash,KeyEqual>,
-						  parlay_unordered_map_indirect<K,V,Hash,KeyEqual>>;
+						  parlay_unordered_map_direct<K,V,Hash,KeyEqual,Policy>,
+						  parlay_unordered_map_indirect<K,V,Hash,KeyEqual,Policy>>;
 }  // namespace parlay
 #endif  // PARLAY_BIGATOMIC_HASH_LIST
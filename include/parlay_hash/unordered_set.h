@@ -20,9 +20,9 @@ namespace parlay {
 
   // Generic unordered_set that can be used with direct or indirect
   // entries depending on the template argument.
-  template <typename Entries>
+  template <typename Entries, typename Policy = default_hash_policy>
   struct unordered_set_internal {
-    using set = parlay_hash<Entries>;
+    using set = parlay_hash<Entries, Policy>;
 
     Entries entries_;
     set m;
@@ -32,27 +32,79 @@ namespace parlay {
     using key_type = K;
     using value_type = K;
     using iterator = typename set::Iterator;
+    using Hash = typename Entries::Hash;
+    using KeyEqual = typename Entries::KeyEqual;
+
+    // enables lookups with keys of type Q other than K
+    template <typename Q, typename H = Hash>
+    using if_lookup_key = std::enable_if_t<!std::is_same_v<Q, K> &&
+					   is_transparent_lookup<H, KeyEqual>::value, int>;
 
     static constexpr auto true_f = [] (const Entry& kv) {return true;};
     static constexpr auto identity = [] (const Entry& kv) {return kv;};
+    static constexpr auto get_key = [] (const K& k) {return k;};
 
-    unordered_set_internal(long n, bool clear_at_end = default_clear_at_end)
+    unordered_set_internal(long n, bool clear_at_end = default_clear_at_end,
+			   bool background_migration = false)
       : entries_(Entries(clear_at_end)),
-	m(set(n, &entries_, clear_at_end)) {}
+	m(set(n, &entries_, clear_at_end, background_migration)) {}
     
     iterator begin() { return m.begin();}
     iterator end() { return m.end();}
-    bool empty() { return size() == 0;}
+    bool empty() { return m.empty();}
     bool max_size() { return (1ul << 47)/sizeof(Entry);}
     void clear() { m.clear_buckets();}
     long size() { return m.size();}
-
-    template <typename F = decltype(identity)>
-    auto entries(const F& f = identity) { return m.entries(f);}
+    long size_estimate() { return m.size_estimate();}
+    void shrink_to_fit() { m.shrink_to_fit();}
+    void reserve(long n) { m.reserve(n);}
+
+    // A sequence with f(k) for each key k in the set.
+    template <typename F = decltype(get_key)>
+    auto entries(const F& f = get_key) {
+      return m.entries([&] (const Entry& e) {return f(e.get_entry());});}
+
+    template <typename F>
+    void for_each(const F& f) {
+      m.for_each([&] (const Entry& e) {f(e.get_entry());});}
+
+    template <typename F, typename Monoid>
+    auto map_reduce(const F& f, const Monoid& monoid) {
+      return m.map_reduce([&] (const Entry& e) {return f(e.get_entry());}, monoid);}
     long count(const K& k) { return (contains(k)) ? 1 : 0; }
-    bool contains(const K& k) { return find(k, true_f).has_value();}
+    bool contains(const K& k) { return Find(k);}
 
     bool Find(const K& k) { return m.Find(Entry::make_key(k), true_f).has_value(); }
+
+    // Find, Remove and contains also accept a key with its hash from
+    // prehash, and keys of other types if Hash and KeyEqual are
+    // transparent.
+    template <typename Q>
+    bool Find(const hashed_key<Q>& k) { return m.Find(k, true_f).has_value(); }
+
+    template <typename Q, if_lookup_key<Q> = 0>
+    bool Find(const Q& k) { return Find(Entry::prehash(k)); }
+
+    template <typename Q>
+    bool contains(const hashed_key<Q>& k) { return Find(k);}
+
+    template <typename Q, if_lookup_key<Q> = 0>
+    bool contains(const Q& k) { return Find(Entry::prehash(k));}
+
+    // The key with its hash, which can be used for lookups in any set
+    // with the same Hash.
+    static hashed_key<K> prehash(const K& k) { return Entry::prehash(k);}
+
+    template <typename Q, if_lookup_key<Q> = 0>
+    static hashed_key<Q> prehash(const Q& k) { return Entry::prehash(k);}
+
+    // out[i] is set to Find(keys[i]) for each i.
+    template <typename Keys, typename Out>
+    void FindBatch(const Keys& keys, Out&& out) {
+      m.FindBatch(keys.size(), [&] (long i) -> decltype(auto) {return keys[i];}, true_f,
+		  [&] (long i, auto&& r) {out[i] = r.has_value();});
+    }
+
     bool Insert(const K& key) 
     {
       auto k = Entry::make_key(key);
@@ -62,7 +114,59 @@ namespace parlay {
     bool Remove(const K& k)
     { return m.Remove(Entry::make_key(k), true_f).has_value(); }
 
-    iterator find(const K& k) { return m.find(k); }
+    template <typename Q>
+    bool Remove(const hashed_key<Q>& k)
+    { return m.Remove(k, true_f).has_value(); }
+
+    template <typename Q, if_lookup_key<Q> = 0>
+    bool Remove(const Q& k)
+    { return Remove(Entry::prehash(k)); }
+
+    // Give up after max_tries attempts (at least 1) that fail because
+    // of other updates to the bucket, or because a resize is copying
+    // it, in which case the result
+    // converts to false.  Otherwise * gives what Find, Insert or
+    // Remove returns.
+    try_result<bool> TryFind(const K& k, long max_tries) {
+      auto r = m.TryFind(Entry::make_key(k), true_f, max_tries);
+      return {r.done, r->has_value()};
+    }
+
+    try_result<bool> TryInsert(const K& key, long max_tries) {
+      auto k = Entry::make_key(key);
+      auto r = m.TryInsert(k, [&] {return entries_.make_entry(k, key);}, true_f, max_tries);
+      return {r.done, r.done && !r->has_value()};
+    }
+
+    try_result<bool> TryRemove(const K& k, long max_tries) {
+      auto r = m.TryRemove(Entry::make_key(k), true_f, max_tries);
+      return {r.done, r->has_value()};
+    }
+
+    // Batched versions of Insert and Remove.  out[i] is set to the
+    // result of the i-th operation.
+    template <typename Keys, typename Out>
+    void InsertBatch(const Keys& keys, Out&& out) {
+      m.InsertBatch(keys.size(), [&] (long i) -> decltype(auto) {return keys[i];},
+		    [&] (long i) {return entries_.make_entry(Entry::make_key(keys[i]), keys[i]);},
+		    true_f, [&] (long i, auto&& r) {out[i] = !r.has_value();});
+    }
+
+    template <typename Keys, typename Out>
+    void RemoveBatch(const Keys& keys, Out&& out) {
+      m.RemoveBatch(keys.size(), [&] (long i) -> decltype(auto) {return keys[i];},
+		    true_f, [&] (long i, auto&& r) {out[i] = r.has_value();});
+    }
+
+    // Replaces the contents with the keys in keys.  Must not be run
+    // concurrently with other operations on the set.
+    template <typename Keys>
+    void build(const Keys& keys) {
+      m.build(keys.size(), [&] (long i) -> decltype(auto) {return keys[i];},
+	      [&] (long i) {return entries_.make_entry(Entry::make_key(keys[i]), keys[i]);});
+    }
+
+    iterator find(const K& k) { return m.find(Entry::make_key(k)); }
 
     std::pair<iterator,bool> insert(const value_type& entry) {
       return m.insert(entries_.make_entry(make_key(entry.first), entry)); }
@@ -72,16 +176,23 @@ namespace parlay {
 
   };
 
-  template <typename K, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>>
-  using parlay_unordered_set_direct = unordered_set_internal<DirectEntries<SetData<K, Hash, KeyEqual>>>;
+  template <typename K, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>,
+	    class Policy = default_hash_policy>
+  using parlay_unordered_set_direct = unordered_set_internal<DirectEntries<SetData<K, Hash, KeyEqual>>, Policy>;
+
+  template <typename K, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>,
+	    class Policy = default_hash_policy>
+  using parlay_unordered_set_fingerprint = unordered_set_internal<DirectEntries<SetData<K, Hash, KeyEqual>, true>, Policy>;
 
-  template <typename K, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>>
-  using parlay_unordered_set_indirect = unordered_set_internal<IndirectEntries<SetData<K, Hash, KeyEqual>>>;
+  template <typename K, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>,
+	    class Policy = default_hash_policy>
+  using parlay_unordered_set_indirect = unordered_set_internal<IndirectEntries<SetData<K, Hash, KeyEqual>>, Policy>;
 
-  template <typename K, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>>
+  template <typename K, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>,
+	    class Policy = default_hash_policy>
   using parlay_unordered_set = std::conditional_t<std::is_trivially_copyable_v<K>,
-						  parlay_unordered_set_direct<K, Hash, KeyEqual>,
-						  parlay_unordered_set_indirect<K, Hash, KeyEqual>>;
+						  parlay_unordered_set_direct<K, Hash, KeyEqual, Policy>,
+						  parlay_unordered_set_indirect<K, Hash, KeyEqual, Policy>>;
 }  // namespace parlay
 #endif  // PARLAY_BIGATOMIC_HASH_LIST
 
@@ -0,0 +1,140 @@
+// Backoff for retry loops that adapts to contention.
+//
+// A backoff is constructed at the start of a retry loop, and pause()
+// is called after each failed attempt.  Pauses spin for a number of
+// iterations that doubles on each failure, up to a maximum, after
+// which the thread yields (sched_yield) instead.  When there are more
+// threads than cores, the thread that others are waiting on (e.g. one
+// in the middle of an update) might be descheduled, and spinning only
+// takes the core it needs.
+//
+// The first spin adapts to the failure rate the thread has seen:
+// each thread keeps a running average of the number of failures per
+// loop, and starts with a longer spin (up to 4x) if its recent loops
+// have failed.
+//
+// pause_on(x, v) is for waits on an atomic x to change from v that
+// can be long (e.g. for another thread to copy a block while
+// resizing).  After spinning and yielding it parks the thread, so the
+// writer must call backoff::wake(x) after changing x.  Parking uses
+// x.wait(v) where available (C++20), and otherwise on Linux a futex
+// on one of a small table of words picked by the address of x (x
+// itself might not be a 32 bit word).  Elsewhere it keeps yielding.
+
+#ifndef PARLAYBACKOFF_H_
+#define PARLAYBACKOFF_H_
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+#if !defined(__cpp_lib_atomic_wait) && defined(__linux__)
+#define PARLAY_FUTEX_PARK
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace parlay {
+
+struct backoff {
+  // number of pauses at the maximum spin before yielding, and number
+  // of yields before pause_on parks
+  static constexpr int spins_at_max = 2;
+  static constexpr int yields_before_park = 16;
+
+  backoff(int initial = 200, int max = 5000)
+    : delay(initial), max_delay(max), failures(0), at_max(0), yields(0) {}
+
+  // Updates the running average (in 16ths) with the failures of this
+  // loop, capped at 3.  Cheap if there is no contention.
+  ~backoff() {
+    int& l = level();
+    if (failures > 0 || l > 0) l = (7 * l + 16 * std::min(failures, 3)) / 8;
+  }
+
+  void pause() {
+    if (failures++ == 0) delay = std::min(max_delay, delay * (16 + level()) / 16);
+    if (delay < max_delay || at_max < spins_at_max) {
+      for (volatile int i=0; i < delay; i++);
+      if (delay == max_delay) at_max++;
+      delay = std::min(2 * delay, max_delay);
+    } else {
+      yields++;
+      std::this_thread::yield();
+    }
+  }
+
+  template <typename T>
+  void pause_on([[maybe_unused]] std::atomic<T>& x, [[maybe_unused]] T v) {
+#if defined(__cpp_lib_atomic_wait)
+    if (yields >= yields_before_park) {
+      x.wait(v);
+      return;
+    }
+#elif defined(PARLAY_FUTEX_PARK)
+    if (yields >= yields_before_park) {
+      park_slot& p = slot_for(&x);
+      p.waiters++;
+      int seq = p.seq.load();
+      // a wake after this load changes seq, so the futex does not sleep
+      if (x.load() == v) futex(&p.seq, FUTEX_WAIT_PRIVATE, seq);
+      p.waiters--;
+      return;
+    }
+#endif
+    pause();
+  }
+
+  template <typename T>
+  static void wake([[maybe_unused]] std::atomic<T>& x) {
+#if defined(__cpp_lib_atomic_wait)
+    x.notify_all();
+#elif defined(PARLAY_FUTEX_PARK)
+    // no system call unless some thread is parked on the slot
+    park_slot& p = slot_for(&x);
+    if (p.waiters.load() > 0) {
+      p.seq++;
+      futex(&p.seq, FUTEX_WAKE_PRIVATE, INT_MAX);
+    }
+#endif
+  }
+
+private:
+  int delay;
+  int max_delay;
+  int failures;
+  int at_max;
+  int yields;
+
+  static int& level() {
+    static thread_local int l = 0;
+    return l;
+  }
+
+#if defined(PARLAY_FUTEX_PARK)
+  // Threads parked on any atomic whose address maps to the slot wait
+  // on seq, which wake increments.  Atomics sharing a slot only cause
+  // spurious wakeups, after which the waiter checks its atomic again.
+  struct alignas(64) park_slot {
+    std::atomic<int> seq{0};
+    std::atomic<int> waiters{0};
+  };
+  static constexpr int num_park_slots = 256;
+
+  static park_slot& slot_for(const void* x) {
+    static park_slot slots[num_park_slots];
+    return slots[(reinterpret_cast<uintptr_t>(x) >> 3) % num_park_slots];
+  }
+
+  static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex needs a plain int");
+  static void futex(std::atomic<int>* addr, int op, int val) {
+    syscall(SYS_futex, reinterpret_cast<int*>(addr), op, val, nullptr, nullptr, 0);
+  }
+#endif
+};
+
+}  // namespace parlay
+#endif  // PARLAYBACKOFF_H_
@@ -2,12 +2,16 @@
 // Epoch-based memory reclamation
 // Supports:
 //     epoch::with_epoch(F f),
-// which runs f within an epoch, as well as:
+// which runs f within an epoch,
+//     epoch::epoch_guard g;
+// which holds an epoch until g is destroyed, as well as:
 //     epoch::New<T>(args...)
 //     epoch::Retire(T* a)   -- delays destruction and free
 //     epoch::Delete(T* a)   -- destructs and frees immediately
 // Retire delays destruction and free until no operation that was in a
 // with_epoch at the time it was run is still within the with_epoch.
+// with_epoch and epoch_guard can be nested within each other on a
+// thread, in which case only the outermost announces the epoch.
 //
 // All operations take constant time overhead (beyond the cost of the
 // system malloc and free).
@@ -99,7 +103,8 @@ struct alignas(64) epoch_s {
 
   struct alignas(64) announce_slot {
     std::atomic<long> last;
-    announce_slot() : last(-1l) {}
+    int depth; // nesting depth, only accessed by the owning thread
+    announce_slot() : last(-1l), depth(0) {}
   };
 
   std::vector<announce_slot> announcements;
@@ -137,6 +142,17 @@ struct alignas(64) epoch_s {
     announcements[id].last.store(-1l, std::memory_order_release);
   }
 
+  // announce and unannounce, but only for the outermost of nested calls
+  int enter() {
+    size_t id = worker_id();
+    if (announcements[id].depth++ == 0) announce();
+    return id;
+  }
+
+  void exit(size_t id) {
+    if (--announcements[id].depth == 0) unannounce(id);
+  }
+
   // top 16 bits are used for the process id, and the bottom 48 for
   // the epoch number
   using state = size_t;
@@ -356,6 +372,9 @@ private:
 
  public:
   memory_pool() {
+    // clear() on destruction uses the epoch and the thread-id pool, so make
+    // sure both are constructed first (and hence destroyed after this).
+    get_epoch(); num_workers();
     long workers = max_num_workers;
     pools = std::vector<old_current>(workers);
     for (int i = 0; i < workers; i++) {
@@ -370,17 +389,17 @@ private:
   void acquire(T* p) { }
 
   template <typename ... Args>
-  T* New(Args... args) {
+  T* New(Args&&... args) {
     wrapper* x = allocate_wrapper();
     T* newv = &x->value;
-    new (newv) T(args...);
+    new (newv) T(std::forward<Args>(args)...);
     return newv;
   }
 
   // f is a function that initializes a new object before it is shared
   template <typename F, typename ... Args>
-  T* New_Init(F f, Args... args) {
-    T* x = New(args...);
+  T* New_Init(F f, Args&&... args) {
+    T* x = New(std::forward<Args>(args)...);
     f(x);
     return x;
   }
@@ -497,6 +516,9 @@ private:
 
  public:
   retire_pool() {
+    // clear() on destruction uses the epoch and the thread-id pool, so make
+    // sure both are constructed first (and hence destroyed after this).
+    get_epoch(); num_workers();
     long workers = max_num_workers;
     pools = std::vector<old_current>(workers);
     for (int i = 0; i < workers; i++) 
@@ -556,7 +578,7 @@ private:
   }
 
   template <typename T, typename ... Args>
-  static T* New(Args... args) {
+  static T* New(Args&&... args) {
     return get_default_pool<T>().New(std::forward<Args>(args)...);}
 
   template <typename T>
@@ -579,17 +601,24 @@ private:
   //template <typename T>
   //static void stats() {get_default_pool<T>().stats();}
 
+  // Holds an epoch from construction to destruction, so anything
+  // retired in the meantime is not freed until it is destroyed.  Must
+  // be destroyed by the thread that created it.  Holding one for a
+  // long time delays all reclamation.
+  struct epoch_guard {
+    int id;
+    epoch_guard() : id(internal::get_epoch().enter()) {}
+    epoch_guard(epoch_guard&& g) : id(g.id) { g.id = -1; }
+    epoch_guard(const epoch_guard&) = delete;
+    epoch_guard& operator=(const epoch_guard&) = delete;
+    epoch_guard& operator=(epoch_guard&&) = delete;
+    ~epoch_guard() { if (id != -1) internal::get_epoch().exit(id); }
+  };
+
   template <typename Thunk>
   auto with_epoch(Thunk f) {
-    int id = internal::get_epoch().announce();
-    if constexpr (std::is_void_v<std::invoke_result_t<Thunk>>) {
-      f();
-      internal::get_epoch().unannounce(id);
-    } else {
-      auto v = f();
-      internal::get_epoch().unannounce(id);
-      return v;
-    }
+    epoch_guard g;
+    return f();
   }
 
 } // end namespace epoch
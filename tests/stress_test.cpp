@@ -0,0 +1,100 @@
+// Stress test of concurrent inserts, removes, finds and shrinks.
+// Each of p threads repeatedly inserts and then removes its own keys,
+// while also looking up and upserting keys shared with the others, and
+// one of them shrinks the table between rounds, so updates run
+// concurrently with copying in both directions.  Checks that every
+// operation on a thread's own keys sees what that thread did, and that
+// the table ends up with exactly the shared keys.
+//
+// Runs with the default policy, and with one that reclaims old
+// versions and shrinks sparse tables on its own, each with direct and
+// indirect entries.
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "unordered_map.h"
+
+struct reclaim_policy : parlay::default_hash_policy {
+  static constexpr bool reclaim_versions = true;
+  static constexpr bool count_size = true;
+};
+
+void check(bool b, const char* what) {
+  if (!b) {
+    std::cout << "error: " << what << std::endl;
+    abort();
+  }
+}
+
+// Key and value types built from a long, for direct and indirect maps
+template <typename T> T make(long i);
+template <> long make<long>(long i) { return i; }
+template <> std::string make<std::string>(long i) { return std::to_string(i); }
+
+template <typename Map, typename K, typename V>
+void stress(const char* name, int p, long n, int rounds) {
+  Map map(1000);
+  long shared = n / 4;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < p; t++) {
+    threads.emplace_back([&, t] {
+      auto own = [&] (long i) {return make<K>(shared + i * p + t);};
+      for (int r = 0; r < rounds; r++) {
+	for (long i = 0; i < n; i++) {
+	  check(!map.Insert(own(i), make<V>(i)).has_value(), "insert of own key found it");
+	  if (i % 8 == 0) {
+	    map.Upsert(make<K>(i % shared), [] (const std::optional<V>& v) {
+	      return v.has_value() ? *v : make<V>(0);});
+	  }
+	}
+	for (long i = 0; i < n; i++) {
+	  auto v = map.Find(own(i));
+	  check(v.has_value() && *v == make<V>(i), "find of own key");
+	}
+	if (t == 0) map.shrink_to_fit();
+	for (long i = 0; i < n; i++) {
+	  auto v = map.Remove(own(i));
+	  check(v.has_value() && *v == make<V>(i), "remove of own key");
+	  check(!map.Find(own(i)).has_value(), "find after remove");
+	}
+	if (t == 0) map.shrink_to_fit();
+      }
+    });
+  }
+  for (auto& th : threads) th.join();
+
+  // only the shared keys upserted by every round remain
+  std::vector<bool> upserted(shared, false);
+  for (long i = 0; i < n; i += 8) upserted[i % shared] = true;
+  long cnt = 0;
+  for (long i = 0; i < shared; i++) {
+    auto v = map.Find(make<K>(i));
+    check(v.has_value() == upserted[i], "shared key");
+    check(!v.has_value() || *v == make<V>(0), "shared value");
+    cnt += upserted[i];
+  }
+  check(map.size() == cnt, "size");
+  map.shrink_to_fit();
+  check(map.size() == cnt, "size after shrink");
+  std::cout << name << " OK" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  int p = (argc > 1) ? std::atoi(argv[1]) : 4;
+  long n = (argc > 2) ? std::atol(argv[2]) : 20000;
+  int rounds = (argc > 3) ? std::atoi(argv[3]) : 3;
+  using parlay::parlay_unordered_map;
+  stress<parlay_unordered_map<long, long>, long, long>("direct", p, n, rounds);
+  stress<parlay_unordered_map<std::string, std::string>, std::string, std::string>(
+    "indirect", p, n, rounds);
+  stress<parlay_unordered_map<long, long, std::hash<long>, std::equal_to<long>, reclaim_policy>,
+	 long, long>("direct reclaiming", p, n, rounds);
+  stress<parlay_unordered_map<std::string, std::string, std::hash<std::string>,
+			      std::equal_to<std::string>, reclaim_policy>,
+	 std::string, std::string>("indirect reclaiming", p, n, rounds);
+  std::cout << "OK" << std::endl;
+}